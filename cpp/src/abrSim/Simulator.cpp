@@ -0,0 +1,150 @@
+#include "Simulator.hpp"
+#include "Connection.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+size_t SegmentTable::getSize(size_t rung, size_t segment) const {
+    const std::vector<size_t>& rung_sizes = sizes[rung];
+    return rung_sizes[segment % rung_sizes.size()];
+}
+
+bool load_trace(const std::string& path, BandwidthTrace& trace) {
+    std::ifstream file(path);
+    if (!file) return false;
+
+    std::string line;
+    bool any_bandwidth = false;
+    while (std::getline(file, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        std::istringstream fields(line);
+        double seconds, kbps;
+        if (!(fields >> seconds >> kbps) || seconds <= 0 || kbps < 0) return false;
+        trace.length += seconds;
+        trace.step_ends.push_back(trace.length);
+        trace.bandwidths.push_back(kbps);
+        any_bandwidth = any_bandwidth || kbps > 0;
+    }
+    // a trace without bandwidth would never finish a download
+    return any_bandwidth;
+}
+
+bool load_segment_table(const std::string& path, SegmentTable& table) {
+    std::ifstream file(path);
+    if (!file) return false;
+
+    std::vector<std::pair<int, std::vector<size_t>>> rungs;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        std::istringstream fields(line);
+        int bitrate;
+        size_t size;
+        if (!(fields >> bitrate) || bitrate <= 0) return false;
+        std::vector<size_t> sizes;
+        while (fields >> size) sizes.push_back(size);
+        if (sizes.empty()) return false;
+        rungs.emplace_back(bitrate, std::move(sizes));
+    }
+    if (rungs.empty()) return false;
+
+    std::sort(rungs.begin(), rungs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (auto& [bitrate, sizes] : rungs) {
+        table.bitrates.push_back(bitrate);
+        table.sizes.push_back(std::move(sizes));
+    }
+    return true;
+}
+
+SegmentTable make_cbr_table(const std::vector<int>& bitrates, double segment_duration) {
+    SegmentTable table;
+    table.bitrates = bitrates;
+    std::sort(table.bitrates.begin(), table.bitrates.end());
+    for (int bitrate : table.bitrates) {
+        // Kbps * seconds -> bytes
+        table.sizes.push_back({static_cast<size_t>(bitrate * segment_duration * 1000 / 8)});
+    }
+    return table;
+}
+
+double download_time(const BandwidthTrace& trace, double start, size_t bytes) {
+    double remaining = static_cast<double>(bytes) * 8 / 1000;  // Kbits
+    double position = std::fmod(start, trace.length);
+    size_t step = std::upper_bound(trace.step_ends.begin(), trace.step_ends.end(), position) - trace.step_ends.begin();
+    if (step == trace.step_ends.size()) step = 0;
+
+    double elapsed = 0.0;
+    while (true) {
+        double step_left = trace.step_ends[step] - position;
+        double bandwidth = trace.bandwidths[step];
+        if (bandwidth > 0 && remaining <= bandwidth * step_left) return elapsed + remaining / bandwidth;
+
+        remaining -= bandwidth * step_left;
+        elapsed += step_left;
+        step = (step + 1) % trace.step_ends.size();
+        position = step == 0 ? 0.0 : trace.step_ends[step - 1];
+    }
+}
+
+// Simulated session time as the TimePoints ClientConnection works with
+static TimePoint at_session_time(double seconds) {
+    return TimePoint{} + std::chrono::duration_cast<TimePoint::duration>(std::chrono::duration<double>(seconds));
+}
+
+SessionResult simulate_session(const BandwidthTrace& trace, const SegmentTable& table,
+                               const BitrateManager& bitrate_manager, const SessionConfig& config) {
+    ClientConnection client(SIM_MANIFEST_PATH);
+    client.setLadder(bitrate_manager.findLadder(SIM_MANIFEST_PATH));
+    client.setSegmentDuration(config.segment_duration);
+
+    SessionResult result;
+    double clock = 0.0;   // Session time (seconds)
+    double buffer = 0.0;  // Seconds of video the player actually holds
+    bool playing = false;
+    int previous_bitrate = 0;
+    double bitrate_sum = 0.0;
+
+    for (size_t segment = 0; segment < config.num_segments; ++segment) {
+        int bitrate = client.selectBitrate(bitrate_manager, config.policy, at_session_time(clock));
+        size_t rung = std::lower_bound(table.bitrates.begin(), table.bitrates.end(), bitrate) - table.bitrates.begin();
+        size_t size = table.getSize(std::min(rung, table.bitrates.size() - 1), segment);
+
+        // playback drains the buffer while the segment downloads, and stalls once it is empty
+        double duration = download_time(trace, config.start_offset + clock, size);
+        clock += duration;
+        if (playing) {
+            buffer -= duration;
+            if (buffer < 0) {
+                result.rebuffer_time -= buffer;
+                buffer = 0;
+            }
+        }
+        buffer += config.segment_duration;
+
+        client.updateThroughput(calculate_throughput(size, duration), config.alpha);
+        client.addBufferedSegment(false, at_session_time(clock));
+        if (!playing && buffer >= config.startup_buffer) {
+            playing = true;
+            result.startup_delay = clock;
+        }
+
+        if (segment > 0 && bitrate != previous_bitrate) ++result.switches;
+        previous_bitrate = bitrate;
+        bitrate_sum += bitrate;
+
+        // a full player waits for playback to make room before requesting more
+        if (playing && buffer > config.max_buffer) {
+            clock += buffer - config.max_buffer;
+            buffer = config.max_buffer;
+        }
+    }
+
+    if (!playing) result.startup_delay = clock;
+    result.average_bitrate = config.num_segments ? bitrate_sum / config.num_segments : 0.0;
+    return result;
+}
@@ -0,0 +1,64 @@
+#ifndef SIMULATOR_HPP
+#define SIMULATOR_HPP
+
+#include "Abr.hpp"
+#include "BitrateManager.hpp"
+#include <string>
+#include <vector>
+
+// Manifest path the simulated ladder is registered under
+const std::string SIM_MANIFEST_PATH = "/sim/vid.mpd";
+
+// Piecewise-constant bandwidth trace; replay wraps around to the start
+struct BandwidthTrace {
+    std::vector<double> step_ends;   // Trace time (seconds) at which each step ends, ascending
+    std::vector<double> bandwidths;  // Kbps during each step
+    double length = 0.0;             // Seconds covered by the trace
+};
+
+// Segment sizes in bytes for every rung of the ladder, by segment number (wrapping)
+struct SegmentTable {
+    std::vector<int> bitrates;               // Ascending
+    std::vector<std::vector<size_t>> sizes;  // sizes[rung][segment]
+
+    size_t getSize(size_t rung, size_t segment) const;
+};
+
+// How one simulated playback session is run
+struct SessionConfig {
+    double alpha = DEFAULT_ALPHA;  // EWMA weight of the newest throughput sample
+    AbrPolicy policy;              // Policy picking each segment's bitrate
+    double segment_duration = DEFAULT_SEGMENT_DURATION;  // Seconds of video per segment
+    size_t num_segments = 100;     // Segments played per session
+    double startup_buffer = DEFAULT_SEGMENT_DURATION;    // Buffered seconds before playback starts
+    double max_buffer = 30.0;      // The player stops requesting while its buffer is this full
+    double start_offset = 0.0;     // Trace time the session starts at
+};
+
+// What the viewer of a simulated session experienced
+struct SessionResult {
+    double average_bitrate = 0.0;  // Kbps, over all segments
+    int switches = 0;              // Bitrate changes between consecutive segments
+    double rebuffer_time = 0.0;    // Seconds playback stalled on an empty buffer
+    double startup_delay = 0.0;    // Seconds until playback started
+};
+
+// Reads "<seconds> <Kbps>" lines ('#' starts a comment); false if the file is unusable
+bool load_trace(const std::string& path, BandwidthTrace& trace);
+
+// Reads "<bitrate> <bytes> <bytes> ..." lines, one per rung; false if the file is unusable
+bool load_segment_table(const std::string& path, SegmentTable& table);
+
+// Constant-bitrate sizes for a ladder: every segment is bitrate * segment_duration
+SegmentTable make_cbr_table(const std::vector<int>& bitrates, double segment_duration);
+
+// Seconds it takes to download bytes when the transfer starts at trace time start
+double download_time(const BandwidthTrace& trace, double start, size_t bytes);
+
+// Play one session through a ClientConnection, so the proxy's own throughput estimate,
+// buffer estimate and ABR policy make every decision. bitrate_manager holds the ladder
+// of table under SIM_MANIFEST_PATH.
+SessionResult simulate_session(const BandwidthTrace& trace, const SegmentTable& table,
+                               const BitrateManager& bitrate_manager, const SessionConfig& config);
+
+#endif  // SIMULATOR_HPP
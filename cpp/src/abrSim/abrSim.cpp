@@ -0,0 +1,179 @@
+#include "Simulator.hpp"
+#include "manifest_parser.hpp"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Everything given on the command line
+struct SimOptions {
+    std::vector<std::string> trace_paths;
+    std::string segments_path;
+    std::vector<int> ladder;
+    std::vector<double> alphas = {DEFAULT_ALPHA};
+    std::vector<std::string> policies = {"throughput"};
+    size_t sessions = 100;  // Sessions per trace, starting at evenly spread trace offsets
+    SessionConfig session;
+};
+
+void print_usage() {
+    std::cerr << "Usage: ./abrSim --trace <file> [--trace <file> ...] [options]\n";
+    std::cerr << "Replays bandwidth traces through miProxy's throughput estimate and ABR policies.\n";
+    std::cerr << "Options (lists are comma-separated; every alpha/policy combination is reported):\n";
+    std::cerr << "  --trace <file>            \"<seconds> <Kbps>\" per line\n";
+    std::cerr << "  --segments <file>         \"<bitrate> <bytes> <bytes> ...\" per rung (default: constant bitrate)\n";
+    std::cerr << "  --ladder <Kbps,...>       Bitrates when no segment table is given (default 500,1000,2000,4000)\n";
+    std::cerr << "  --manifest <vid.mpd>      Take the ladder and segment duration from a manifest\n";
+    std::cerr << "  --alpha <a,...>           EWMA weights to try (default 0.2)\n";
+    std::cerr << "  --abr <policy,...>        throughput and/or buffer (default throughput)\n";
+    std::cerr << "  --sessions <n>            Sessions per trace (default 100)\n";
+    std::cerr << "  --num-segments <n>        Segments per session (default 100)\n";
+    std::cerr << "  --segment-duration <s>    Seconds of video per segment (default 4)\n";
+    std::cerr << "  --startup-buffer <s>      Buffered seconds before playback starts (default 4)\n";
+    std::cerr << "  --max-buffer <s>          Buffer the player fills up to (default 30)\n";
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string& value, T (*convert)(const std::string&, size_t*)) {
+    std::vector<T> items;
+    std::istringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) items.push_back(convert(item, nullptr));
+    if (items.empty()) throw std::invalid_argument(value);
+    return items;
+}
+
+int to_int(const std::string& text, size_t* pos) {
+    return std::stoi(text, pos);
+}
+
+double to_double(const std::string& text, size_t* pos) {
+    return std::stod(text, pos);
+}
+
+std::string to_string(const std::string& text, size_t*) {
+    return text;
+}
+
+// Parses the "--name value" pairs in argv[1..argc)
+bool parse_options(int argc, char* argv[], SimOptions& options) {
+    for (int i = 1; i < argc; i += 2) {
+        std::string name = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for option " << name << "\n";
+            return false;
+        }
+        std::string value = argv[i + 1];
+
+        try {
+            if (name == "--trace") {
+                options.trace_paths.push_back(value);
+            } else if (name == "--segments") {
+                options.segments_path = value;
+            } else if (name == "--ladder") {
+                options.ladder = parse_list(value, to_int);
+            } else if (name == "--manifest") {
+                std::ifstream file(value);
+                std::stringstream content;
+                content << file.rdbuf();
+                options.ladder = parse_available_bitrates(content.str());
+                double segment_duration = parse_segment_duration(content.str());
+                if (!file || options.ladder.empty()) throw std::invalid_argument(value);
+                if (segment_duration > 0) options.session.segment_duration = segment_duration;
+            } else if (name == "--alpha") {
+                options.alphas = parse_list(value, to_double);
+            } else if (name == "--abr") {
+                options.policies = parse_list(value, to_string);
+                for (const std::string& policy : options.policies) {
+                    if (!make_abr_policy(policy)) throw std::invalid_argument(policy);
+                }
+            } else if (name == "--sessions") {
+                options.sessions = std::stoul(value);
+            } else if (name == "--num-segments") {
+                options.session.num_segments = std::stoul(value);
+            } else if (name == "--segment-duration") {
+                options.session.segment_duration = std::stod(value);
+            } else if (name == "--startup-buffer") {
+                options.session.startup_buffer = std::stod(value);
+            } else if (name == "--max-buffer") {
+                options.session.max_buffer = std::stod(value);
+            } else {
+                std::cerr << "Unknown option " << name << "\n";
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value for option " << name << ": " << value << "\n";
+            return false;
+        }
+    }
+    return !options.trace_paths.empty() && options.sessions > 0 && options.session.segment_duration > 0;
+}
+
+int main(int argc, char* argv[]) {
+    SimOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+
+    std::vector<BandwidthTrace> traces(options.trace_paths.size());
+    for (size_t i = 0; i < traces.size(); ++i) {
+        if (!load_trace(options.trace_paths[i], traces[i])) {
+            std::cerr << "Error: cannot read trace " << options.trace_paths[i] << "\n";
+            return 1;
+        }
+    }
+
+    SegmentTable table;
+    if (!options.segments_path.empty()) {
+        if (!load_segment_table(options.segments_path, table)) {
+            std::cerr << "Error: cannot read segment table " << options.segments_path << "\n";
+            return 1;
+        }
+    } else {
+        if (options.ladder.empty()) options.ladder = {500, 1000, 2000, 4000};
+        table = make_cbr_table(options.ladder, options.session.segment_duration);
+    }
+
+    // the same shared ladder lookup the proxy does for every segment request
+    BitrateManager bitrate_manager;
+    bitrate_manager.addBitrates(SIM_MANIFEST_PATH, table.bitrates);
+
+    std::printf("%-10s %6s %9s %12s %9s %12s %12s\n", "policy", "alpha", "sessions", "avg_kbps", "switches",
+                "rebuffer_s", "startup_s");
+    size_t total_sessions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& policy : options.policies) {
+        for (double alpha : options.alphas) {
+            SessionConfig config = options.session;
+            config.policy = *make_abr_policy(policy);
+            config.alpha = alpha;
+
+            SessionResult sum;
+            size_t sessions = 0;
+            for (const BandwidthTrace& trace : traces) {
+                for (size_t i = 0; i < options.sessions; ++i) {
+                    config.start_offset = trace.length * i / options.sessions;
+                    SessionResult result = simulate_session(trace, table, bitrate_manager, config);
+                    sum.average_bitrate += result.average_bitrate;
+                    sum.switches += result.switches;
+                    sum.rebuffer_time += result.rebuffer_time;
+                    sum.startup_delay += result.startup_delay;
+                    ++sessions;
+                }
+            }
+            total_sessions += sessions;
+            std::printf("%-10s %6.2f %9zu %12.1f %9.2f %12.2f %12.2f\n", policy.c_str(), alpha, sessions,
+                        sum.average_bitrate / sessions, static_cast<double>(sum.switches) / sessions,
+                        sum.rebuffer_time / sessions, sum.startup_delay / sessions);
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%zu sessions in %.3f s (%.0f sessions/s)\n", total_sessions, elapsed,
+                elapsed > 0 ? total_sessions / elapsed : 0.0);
+    return 0;
+}
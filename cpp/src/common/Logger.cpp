@@ -28,7 +28,7 @@ bool Logger::log_message(const std::string& message) {
 // Logs chunk download activity in the format: 
 // <browser-ip> <chunkname> <server-ip> <duration> <tput> <avg-tput> <bitrate>
 bool Logger::log_chunk_transfer(const std::string& browser_ip, const std::string& chunkname, const std::string& server_ip,
-                        double duration, double tput, double avg_tput, int bitrate) {
+                        double duration, double tput, double avg_tput, int bitrate, const ChunkPhases* phases) {
     // log_file << browser_ip << " "
     //          << chunkname << " "
     //          << server_ip << " "
@@ -36,6 +36,14 @@ bool Logger::log_chunk_transfer(const std::string& browser_ip, const std::string
     //          << std::fixed << std::setprecision(2) << tput << " "      // Throughput in Kbps, 2 decimal places
     //          << avg_tput << " "                                        // Average throughput (EWMA) in Kbps
     //          << bitrate << std::endl;                                  // Requested bitrate in Kbps
+    if (phases) {
+        // phases that did not happen (no client side for a prefetch) are logged as "-"
+        auto phase = [](double seconds) { return seconds < 0 ? std::string("-") : fmt::format("{:.3f}", seconds); };
+        spdlog::info("{} {} {} {:.3f} {:.2f} {:.2f} {} {} {} {} {} {}", browser_ip, chunkname, server_ip, duration, tput,
+                     avg_tput, bitrate, phase(phases->queue), phase(phases->ttfb), phase(phases->header),
+                     phase(phases->body), phase(phases->client));
+        return true;
+    }
     spdlog::info("{} {} {} {:.3f} {:.2f} {:.2f} {}", browser_ip, chunkname, server_ip, duration, tput, avg_tput, bitrate);
     return true;
 }
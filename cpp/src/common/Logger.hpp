@@ -4,6 +4,15 @@
 #include <string>
 #include <fstream>
 
+// Seconds spent in each phase of a proxied chunk request; -1 for a phase that did not happen
+struct ChunkPhases {
+    double queue;   // Request read from the client until sent to the web server
+    double ttfb;    // Request sent until the first response byte
+    double header;  // First response byte until the header is complete
+    double body;    // Header complete until the last body byte
+    double client;  // Last body byte until the client received everything
+};
+
 class Logger {
 private:
     std::ofstream log_file;
@@ -18,9 +27,11 @@ public:
     // Logs a generic message (for startup events, errors, etc.)
     bool log_message(const std::string& message);
 
-    // Logs chunk download activity with the specified details
+    // Logs chunk download activity with the specified details, followed by the phase
+    // durations when given: <queue> <ttfb> <header> <body> <client>
     bool log_chunk_transfer(const std::string& browser_ip, const std::string& chunkname, const std::string& server_ip,
-                            double duration, double tput, double avg_tput, int bitrate);
+                            double duration, double tput, double avg_tput, int bitrate,
+                            const ChunkPhases* phases = nullptr);
 
     // Logs chunk download activity in the format: 
     // <browser-ip> <chunkname> <server-ip> <duration> <tput> <avg-tput> <bitrate>
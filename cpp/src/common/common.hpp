@@ -18,19 +18,19 @@ constexpr double DEFAULT_ALPHA = 0.2;
 using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
 
 // Function to get the current time (for time measurement)
-TimePoint get_current_time() {
+inline TimePoint get_current_time() {
     return std::chrono::steady_clock::now();
 }
 
 // Function to calculate the duration between two time points in seconds
-double calculate_duration(const TimePoint& start, const TimePoint& end) {
+inline double calculate_duration(const TimePoint& start, const TimePoint& end) {
     return std::chrono::duration<double>(end - start).count();  // Duration in seconds
 }
 
 // --- Utility Functions ---
 
 // Utility function to trim whitespace from the start and end of a string (if needed)
-std::string trim(const std::string& str) {
+inline std::string trim(const std::string& str) {
     size_t start = str.find_first_not_of(" \t\n\r");
     size_t end = str.find_last_not_of(" \t\n\r");
 
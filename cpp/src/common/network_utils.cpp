@@ -1,5 +1,7 @@
 #include "network_utils.h"
 
+#include <linux/tcp.h>  // struct tcp_info (glibc's copy lacks the newer fields)
+
 #include <stdio.h>      // spdlog::error(), fprintf()
 #include <string.h>     // memcpy()
 #include <sys/socket.h> // getsockname(), send()
@@ -56,3 +58,26 @@ int send_data(int sockfd, std::string_view bytes) {
     } while (sent < bytes.size());
     return 0;
 }
+
+std::string ip_to_string(const struct in_addr &addr) {
+    char buf[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &addr, buf, sizeof(buf)) == nullptr) {
+        return "";
+    }
+    return buf;
+}
+
+int get_tcp_info(int sockfd, TcpInfo *info) {
+    struct tcp_info tcp = {};
+    socklen_t length = sizeof(tcp);
+    if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &tcp, &length) == -1) {
+        return -1;
+    }
+    // older kernels fill in a shorter struct; the rest stays zeroed
+    info->bytes_received = tcp.tcpi_bytes_received;
+    info->delivery_rate = tcp.tcpi_delivery_rate;
+    info->delivery_rate_app_limited = tcp.tcpi_delivery_rate_app_limited;
+    info->rtt = tcp.tcpi_rtt;
+    info->min_rtt = tcp.tcpi_min_rtt;
+    return 0;
+}
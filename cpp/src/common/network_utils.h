@@ -4,6 +4,8 @@
 #include <arpa/inet.h>  // htons(), ntohs()
 #include <netdb.h>      // gethostbyname(), struct hostent
 #include <netinet/in.h> // struct sockaddr_in
+#include <cstdint>
+#include <string>
 #include <string_view>
 
 /**
@@ -55,4 +57,42 @@ int get_port_number(int sockfd);
  */
 int send_data(int sockfd, std::string_view bytes);
 
+/**
+ * Format an IPv4 address as a dotted-quad string.
+ *
+ * Unlike inet_ntoa(), this is safe to call from several threads at once.
+ *
+ * Parameters:
+ *   addr:  The address to format.
+ *
+ * Returns:
+ *   The address as a string like "127.0.0.1".
+ */
+std::string ip_to_string(const struct in_addr &addr);
+
+/**
+ * The parts of the kernel's TCP_INFO for a connection used to estimate throughput.
+ */
+struct TcpInfo {
+    uint64_t bytes_received;   // Payload bytes received on the connection so far
+    uint64_t delivery_rate;    // Most recent delivery rate sample, bytes per second
+    bool delivery_rate_app_limited;  // That sample was limited by the sender, not the network
+    uint32_t rtt;              // Smoothed round-trip time, microseconds
+    uint32_t min_rtt;          // Minimum round-trip time seen, microseconds
+};
+
+/**
+ * Read the TCP_INFO of a connected TCP socket.
+ *
+ * Fields the running kernel does not report are left 0.
+ *
+ * Parameters:
+ *   sockfd:  File descriptor of a TCP socket.
+ *   info:    The TcpInfo to fill in.
+ *
+ * Returns:
+ *   0 on success, -1 on failure.
+ */
+int get_tcp_info(int sockfd, TcpInfo *info);
+
 #endif // NETWORK_UTILS_H
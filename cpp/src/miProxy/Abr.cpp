@@ -0,0 +1,29 @@
+#include "Abr.hpp"
+
+// BOLA buffer targets (seconds): below the minimum the lowest bitrate wins; the target
+// grows with the number of rungs so each one gets a slice of buffer
+constexpr double BOLA_MIN_BUFFER = 10.0;
+constexpr double BOLA_BUFFER_PER_LEVEL = 2.0;
+
+BitrateLadder::BitrateLadder(std::vector<int> bitrates) : bitrates(std::move(bitrates)) {
+    if (this->bitrates.empty()) return;
+    double lowest = std::max(this->bitrates.front(), 1);
+    for (int bitrate : this->bitrates) {
+        thresholds.push_back(THROUGHPUT_SAFETY_FACTOR * bitrate);
+        utilities.push_back(std::log(std::max(bitrate, 1) / lowest) + 1.0);
+    }
+
+    // with a single rung (or identical ones) there is nothing to trade off
+    double highest_utility = utilities.back();
+    if (highest_utility > 1.0) {
+        double buffer_target = BOLA_MIN_BUFFER + BOLA_BUFFER_PER_LEVEL * this->bitrates.size();
+        bola_gamma = (highest_utility - 1.0) / (buffer_target / BOLA_MIN_BUFFER - 1.0);
+        bola_v = BOLA_MIN_BUFFER / bola_gamma;
+    }
+}
+
+std::optional<AbrPolicy> make_abr_policy(const std::string& name) {
+    if (name == ThroughputPolicy::name) return ThroughputPolicy{};
+    if (name == BufferPolicy::name) return BufferPolicy{};
+    return std::nullopt;
+}
@@ -0,0 +1,101 @@
+#ifndef ABR_HPP
+#define ABR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Seconds of video per segment when the manifest does not say
+constexpr double DEFAULT_SEGMENT_DURATION = 4.0;
+
+// A bitrate is supported once the throughput estimate reaches this multiple of it
+constexpr double THROUGHPUT_SAFETY_FACTOR = 1.5;
+
+// A manifest's bitrates along with everything the ABR policies derive from them, worked
+// out once when the manifest is stored rather than on every segment request
+struct BitrateLadder {
+    explicit BitrateLadder(std::vector<int> bitrates);
+
+    std::vector<int> bitrates;       // Ascending
+    std::vector<double> thresholds;  // Throughput each bitrate needs (ascending)
+    std::vector<double> utilities;   // BOLA utility of each bitrate, ln(bitrate / lowest) + 1
+    double bola_gamma = 0.0;         // BOLA parameters placing the top rung at the buffer target
+    double bola_v = 0.0;
+};
+
+// What an ABR policy knows about a player when it picks the bitrate of the next segment
+struct PlayerState {
+    double throughput = 0.0;        // EWMA throughput estimate (Kbps)
+    double buffer_level = 0.0;      // Estimated seconds of video buffered ahead of playback
+    double segment_duration = DEFAULT_SEGMENT_DURATION;  // Seconds of video per segment
+};
+
+// Counters describing what bitrate decisions cost
+struct AbrStats {
+    uint64_t decisions = 0;   // Bitrates selected
+    double total_ns = 0.0;    // Time spent selecting them
+    double max_ns = 0.0;      // Slowest decision
+};
+
+// ABR policies are plain classes with an inline selectBitrate(ladder, player), called
+// once per segment request with a non-empty ladder, and a name.
+
+// Highest bitrate the throughput estimate covers 1.5 times, else the lowest one
+struct ThroughputPolicy {
+    static constexpr const char* name = "throughput";
+
+    int selectBitrate(const BitrateLadder& ladder, const PlayerState& player) const {
+        // the thresholds ascend, so the bitrates covered are the ones before the first
+        // threshold above the estimate
+        auto it = std::upper_bound(ladder.thresholds.begin(), ladder.thresholds.end(), player.throughput);
+        size_t covered = it - ladder.thresholds.begin();
+        return ladder.bitrates[covered > 0 ? covered - 1 : 0];
+    }
+};
+
+// Buffer-based policy in the style of BOLA: the bitrate maximizing
+// (V * (utility + gamma) - buffer) / bitrate, so a full buffer buys a higher bitrate and
+// a draining one backs off before the player stalls. Decisions never exceed what the
+// measured throughput sustains.
+struct BufferPolicy {
+    static constexpr const char* name = "buffer";
+
+    int selectBitrate(const BitrateLadder& ladder, const PlayerState& player) const {
+        size_t best = 0;
+        double best_score = -HUGE_VAL;
+        for (size_t i = 0; i < ladder.bitrates.size(); ++i) {
+            // a segment the link cannot deliver in real time drains the buffer, whatever its score
+            if (i > 0 && player.throughput > 0 && ladder.bitrates[i] > player.throughput) break;
+
+            double score = (ladder.bola_v * (ladder.utilities[i] + ladder.bola_gamma) - player.buffer_level) /
+                           std::max(ladder.bitrates[i], 1);
+            if (score >= best_score) {
+                best_score = score;
+                best = i;
+            }
+        }
+        return ladder.bitrates[best];
+    }
+};
+
+// The policy a worker runs, chosen at startup. Every alternative is known at compile
+// time, so a decision is a switch over them with the policy's code inlined, not a
+// virtual call.
+using AbrPolicy = std::variant<ThroughputPolicy, BufferPolicy>;
+
+inline int select_bitrate(const AbrPolicy& policy, const BitrateLadder& ladder, const PlayerState& player) {
+    return std::visit([&](const auto& rule) { return rule.selectBitrate(ladder, player); }, policy);
+}
+
+inline const char* get_abr_policy_name(const AbrPolicy& policy) {
+    return std::visit([](const auto& rule) { return rule.name; }, policy);
+}
+
+// Policy by name ("throughput" or "buffer"); empty if the name is unknown
+std::optional<AbrPolicy> make_abr_policy(const std::string& name);
+
+#endif  // ABR_HPP
@@ -1,4 +1,11 @@
 #include "BitrateManager.hpp"
+#include "network_utils.h"
+#include <algorithm>
+#include <mutex>
+
+// Shortest interval a TCP_INFO byte count is timed over (seconds); anything quicker is
+// dominated by timer and scheduling noise
+constexpr double MIN_TCP_RATE_INTERVAL = 0.001;
 
 // Function to calculate throughput in Kbps
 // chunk_size is in bytes and duration is in seconds
@@ -7,26 +14,203 @@ double calculate_throughput(size_t chunk_size, double duration) {
     return (static_cast<double>(chunk_size) * 8) / (duration * 1000);  // Return throughput in Kbps
 }
 
+TcpRateMark mark_tcp_rate(int web_sock) {
+    TcpRateMark mark;
+    TcpInfo info;
+    if (get_tcp_info(web_sock, &info) == 0) {
+        mark.time = get_current_time();
+        mark.bytes_received = info.bytes_received;
+        mark.valid = true;
+    }
+    return mark;
+}
+
+TcpRateSample sample_tcp_rate(int web_sock, const TcpRateMark& mark) {
+    TcpRateSample sample;
+    TcpInfo info;
+    if (get_tcp_info(web_sock, &info) != 0) return sample;
+    sample.rtt = info.rtt / 1000.0;
+    sample.min_rtt = info.min_rtt / 1000.0;
+
+    double duration = mark.valid ? calculate_duration(mark.time, get_current_time()) : 0.0;
+    if (duration >= MIN_TCP_RATE_INTERVAL && info.bytes_received > mark.bytes_received) {
+        sample.throughput = calculate_throughput(info.bytes_received - mark.bytes_received, duration);
+    } else if (info.delivery_rate > 0 && !info.delivery_rate_app_limited) {
+        sample.throughput = calculate_throughput(info.delivery_rate, 1.0);
+    }
+    return sample;
+}
+
+// Lookups refresh a title's LRU stamp at most this often, so players streaming the same
+// title from several workers do not keep writing to the same cache line
+constexpr TimePoint::rep LRU_STAMP_GRANULARITY =
+    std::chrono::duration_cast<TimePoint::duration>(std::chrono::seconds(1)).count();
+
+// Constructor
+BitrateManager::BitrateManager(size_t max_titles)
+    : max_titles(std::max<size_t>(max_titles, 1)), slots(new Slot[this->max_titles]),
+      index(std::make_shared<const TitleIndex>()) {
+    free_slots.reserve(this->max_titles);
+    for (size_t i = this->max_titles; i > 0; --i) free_slots.push_back(i - 1);
+}
+
 // Add or update the bitrates for a given manifest path
-void BitrateManager::addBitrates(const std::string& manifest_path, const std::vector<int>& bitrates) {
-    available_bitrate_map[manifest_path] = bitrates;
+BitrateManager::LadderId BitrateManager::addBitrates(const std::string& manifest_path,
+                                                     const std::vector<int>& bitrates) {
+    // a refetched manifest usually has the same ladder; keep the published one
+    std::shared_ptr<const Title> current = findTitle(manifest_path);
+    if (current && current->ladder && current->ladder->bitrates == bitrates) return makeId(*current);
+
+    // build the new ladder before taking the lock; readers holding the old one keep it alive
+    Ladder ladder = std::make_shared<const BitrateLadder>(bitrates);
+    std::lock_guard<std::mutex> lock(write_mutex);
+    std::shared_ptr<Title> title = copyTitle(claimSlot(manifest_path));
+    title->ladder = std::move(ladder);
+    LadderId id = makeId(*title);
+    slots[title->slot].title.store(std::move(title));
+    return id;
+}
+
+// Retrieve the bitrates for a ladder id
+BitrateManager::Ladder BitrateManager::getBitrates(LadderId ladder) const {
+    size_t slot = static_cast<uint32_t>(ladder) - size_t(1);
+    if (ladder == NO_LADDER || slot >= max_titles) return nullptr;
+
+    std::shared_ptr<const Title> title = slots[slot].title.load();
+    if (!title || title->generation != static_cast<uint32_t>(ladder >> 32)) return nullptr;
+    touch(slots[slot]);
+    return title->ladder;
+}
+
+BitrateManager::LadderId BitrateManager::findLadder(const std::string& manifest_path) const {
+    std::shared_ptr<const Title> title = findTitle(manifest_path);
+    return title && title->ladder ? makeId(*title) : NO_LADDER;
+}
+
+// Add or update the ladder and both forms of the manifest at a given path
+BitrateManager::Manifest BitrateManager::addManifest(const std::string& manifest_path,
+                                                     const std::vector<int>& bitrates, ManifestForms forms) {
+    std::shared_ptr<const Title> current = findTitle(manifest_path);
+    Ladder ladder = current && current->ladder && current->ladder->bitrates == bitrates
+                        ? current->ladder
+                        : std::make_shared<const BitrateLadder>(bitrates);
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    std::shared_ptr<Title> title = copyTitle(claimSlot(manifest_path));
+    title->ladder = std::move(ladder);
+    forms.ladder = makeId(*title);
+    Manifest manifest = std::make_shared<const ManifestForms>(std::move(forms));
+    title->forms = manifest;
+    title->validated_at = get_current_time();
+    slots[title->slot].title.store(std::move(title));
+    return manifest;
 }
 
-// Retrieve the bitrates for a given manifest path
-const std::vector<int>* BitrateManager::getBitrates(const std::string& manifest_path) const {
-    auto it = available_bitrate_map.find(manifest_path);
-    if (it != available_bitrate_map.end()) {
-        return &(it->second);
+// Retrieve the manifest at a given path, and whether its TTL ran out
+BitrateManager::Manifest BitrateManager::getManifest(const std::string& manifest_path, double ttl,
+                                                     bool& expired) const {
+    std::shared_ptr<const Title> title = findTitle(manifest_path);
+    if (title && title->forms) {
+        touch(slots[title->slot]);
+        expired = calculate_duration(title->validated_at, get_current_time()) > ttl;
+        return title->forms;
     }
+    expired = true;
     return nullptr;
 }
 
-// Remove the bitrates for a given manifest path
+// Restart the TTL of a manifest the web server confirmed unchanged
+void BitrateManager::revalidateManifest(const std::string& manifest_path) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    std::shared_ptr<const Title> current = findTitle(manifest_path);
+    if (!current) return;
+    std::shared_ptr<Title> title = copyTitle(current->slot);
+    title->validated_at = get_current_time();
+    slots[title->slot].title.store(std::move(title));
+}
+
+// Remove the bitrates (and manifest) for a given manifest path
 void BitrateManager::removeBitrates(const std::string& manifest_path) {
-    available_bitrate_map.erase(manifest_path);
+    std::lock_guard<std::mutex> lock(write_mutex);
+    std::shared_ptr<const Title> title = findTitle(manifest_path);
+    if (title) releaseSlot(title->slot);
 }
 
-// Clear all stored bitrates
+// Clear all stored bitrates and manifests
 void BitrateManager::clear() {
-    available_bitrate_map.clear();
+    std::lock_guard<std::mutex> lock(write_mutex);
+    std::shared_ptr<const TitleIndex> current = index.load();
+    for (const auto& [path, slot] : *current) releaseSlot(slot);
+}
+
+// Snapshot of the title at manifest_path (nullptr if unknown). The slot may change hands
+// between reading the index and the slot, hence the path check.
+std::shared_ptr<const BitrateManager::Title> BitrateManager::findTitle(const std::string& manifest_path) const {
+    std::shared_ptr<const TitleIndex> current = index.load();
+    auto it = current->find(manifest_path);
+    if (it == current->end()) return nullptr;
+    std::shared_ptr<const Title> title = slots[it->second].title.load();
+    return title && title->manifest_path == manifest_path ? title : nullptr;
+}
+
+// Copy of a claimed slot's title, to be changed and published (caller holds write_mutex)
+std::shared_ptr<BitrateManager::Title> BitrateManager::copyTitle(size_t slot) const {
+    return std::make_shared<Title>(*slots[slot].title.load());
+}
+
+// Slot of manifest_path, taking a free slot or the least recently used one if it has
+// none yet (caller holds write_mutex)
+size_t BitrateManager::claimSlot(const std::string& manifest_path) {
+    std::shared_ptr<const TitleIndex> current = index.load();
+    auto it = current->find(manifest_path);
+    if (it != current->end()) return it->second;
+
+    if (free_slots.empty()) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < max_titles; ++i) {
+            if (slots[i].last_used.load(std::memory_order_relaxed) <
+                slots[oldest].last_used.load(std::memory_order_relaxed)) {
+                oldest = i;
+            }
+        }
+        releaseSlot(oldest);
+    }
+
+    size_t slot = free_slots.back();
+    free_slots.pop_back();
+    auto title = std::make_shared<Title>();
+    title->manifest_path = manifest_path;
+    title->slot = slot;
+    title->generation = slots[slot].generation;
+    slots[slot].title.store(std::move(title));
+    touch(slots[slot]);
+
+    auto updated = std::make_shared<TitleIndex>(*index.load());
+    updated->emplace(manifest_path, slot);
+    index.store(std::move(updated));
+    return slot;
+}
+
+// Empty a slot; ids handed out for it stop resolving (caller holds write_mutex)
+void BitrateManager::releaseSlot(size_t slot) {
+    std::shared_ptr<const Title> title = slots[slot].title.exchange(nullptr);
+    ++slots[slot].generation;
+    free_slots.push_back(slot);
+    if (!title) return;
+
+    auto updated = std::make_shared<TitleIndex>(*index.load());
+    updated->erase(title->manifest_path);
+    index.store(std::move(updated));
+}
+
+BitrateManager::LadderId BitrateManager::makeId(const Title& title) {
+    return (static_cast<LadderId>(title.generation) << 32) | (title.slot + 1);
+}
+
+// Refresh the LRU stamp of a title being looked up
+void BitrateManager::touch(const Slot& slot) const {
+    TimePoint::rep now = get_current_time().time_since_epoch().count();
+    if (now - slot.last_used.load(std::memory_order_relaxed) >= LRU_STAMP_GRANULARITY) {
+        slot.last_used.store(now, std::memory_order_relaxed);
+    }
 }
@@ -1,31 +1,138 @@
 #ifndef BITRATE_MANAGER_HPP
 #define BITRATE_MANAGER_HPP
 
-#include <map>
+#include "common.hpp"
+#include "Abr.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
-#include <optional>
+#include <unordered_map>
 
 // Calculates throughput based on chunk size and duration
 double calculate_throughput(size_t chunk_size, double duration);
 
+// Where a transfer stood on its web server connection once the response header arrived.
+// Measuring from here leaves the server's think time and the request's queueing out.
+struct TcpRateMark {
+    TimePoint time;
+    uint64_t bytes_received = 0;
+    bool valid = false;  // The kernel reported TCP_INFO for the connection
+};
+
+// Throughput of a transfer as the kernel saw it on the web server connection
+struct TcpRateSample {
+    double throughput = 0.0;  // Kbps; 0 when TCP_INFO could not tell
+    double rtt = 0.0;         // Smoothed round-trip time, ms
+    double min_rtt = 0.0;     // Minimum round-trip time, ms
+};
+
+TcpRateMark mark_tcp_rate(int web_sock);
+
+// Rate of the bytes received on web_sock since mark. When the body arrived in one go
+// (too fast to time), falls back to the kernel's delivery rate sample if the network
+// rather than the sender limited it.
+TcpRateSample sample_tcp_rate(int web_sock, const TcpRateMark& mark);
+
+// Default number of titles whose ladder and manifest are kept
+constexpr size_t DEFAULT_MAX_TITLES = 1024;
+
+// Shared by every proxy worker thread. Each title (manifest path) is interned to a slot
+// of a flat table when its manifest is parsed, and players hold the slot's LadderId, so
+// the per-segment ladder lookup is an array index rather than a string map walk. Beyond
+// max_titles, the least recently used title gives up its slot; ids handed out for it
+// then stop resolving.
+//
+// Readers never lock: a slot's ladder, manifest and TTL stamp form an immutable snapshot
+// that writers replace as a whole with an atomic store (read-copy-update), and the path
+// index is republished the same way when a title is added or evicted. A reader keeps
+// the snapshot it loaded for as long as it holds it. Writers are serialized.
 class BitrateManager {
 public:
-    // Add or update the bitrates for a given manifest path
-    void addBitrates(const std::string& manifest_path, const std::vector<int>& bitrates);
+    // Immutable bitrate ladder; stays valid for the holder even if it is replaced
+    using Ladder = std::shared_ptr<const BitrateLadder>;
+
+    // Slot generation in the upper 32 bits, slot index + 1 in the lower; 0 for none
+    using LadderId = uint64_t;
+    static constexpr LadderId NO_LADDER = 0;
+
+    // Both forms of a fetched manifest: the full one the ladder is parsed from, and the
+    // "-no-list" response (header and body) handed to players, plus the validators the
+    // web server sent so an expired copy can be revalidated conditionally
+    struct ManifestForms {
+        std::string full;
+        std::string client_response;
+        std::string etag;
+        std::string last_modified;
+        double segment_duration = 0.0;  // Seconds of video per segment, 0 if not given
+        LadderId ladder = NO_LADDER;    // Id of the title's ladder, set by addManifest
+    };
+    using Manifest = std::shared_ptr<const ManifestForms>;
+
+    // Constructor; keeps the ladders and manifests of up to max_titles titles
+    explicit BitrateManager(size_t max_titles = DEFAULT_MAX_TITLES);
 
-    // Retrieve the bitrates for a given manifest path
-    const std::vector<int>* getBitrates(const std::string& manifest_path) const;
+    // Add or update the bitrates for a given manifest path (an unchanged ladder is kept);
+    // returns the title's ladder id
+    LadderId addBitrates(const std::string& manifest_path, const std::vector<int>& bitrates);
 
-    // Remove the bitrates for a given manifest path
+    // Retrieve the bitrates for a ladder id (nullptr if unknown or evicted)
+    Ladder getBitrates(LadderId ladder) const;
+
+    // Id of the ladder for a given manifest path (NO_LADDER if unknown)
+    LadderId findLadder(const std::string& manifest_path) const;
+
+    // Add or update the ladder and both forms of the manifest at a given path, stamped
+    // as validated now; returns the stored entry
+    Manifest addManifest(const std::string& manifest_path, const std::vector<int>& bitrates, ManifestForms forms);
+
+    // Retrieve the manifest at a given path (nullptr if unknown). expired is set when it
+    // was validated with the web server more than ttl seconds ago.
+    Manifest getManifest(const std::string& manifest_path, double ttl, bool& expired) const;
+
+    // The web server confirmed the manifest is unchanged; restart its TTL
+    void revalidateManifest(const std::string& manifest_path);
+
+    // Remove the bitrates (and manifest) for a given manifest path
     void removeBitrates(const std::string& manifest_path);
 
-    // Clear all stored bitrates
+    // Clear all stored bitrates and manifests
     void clear();
 
 private:
-    // Map to store available bitrates for each manifest path
-    std::map<std::string, std::vector<int>> available_bitrate_map;
+    // What a slot holds at one point in time; never modified once published
+    struct Title {
+        std::string manifest_path;
+        size_t slot = 0;
+        uint32_t generation = 0;
+        Ladder ladder;
+        Manifest forms;
+        TimePoint validated_at;  // Last time the web server sent or confirmed the manifest
+    };
+    using TitleIndex = std::unordered_map<std::string, size_t>;  // Manifest path to slot
+
+    struct Slot {
+        std::atomic<std::shared_ptr<const Title>> title;  // nullptr while free
+        uint32_t generation = 0;  // Bumped whenever the slot changes hands (guarded by write_mutex)
+        mutable std::atomic<TimePoint::rep> last_used{0};  // Steady clock ticks of the last lookup
+    };
+
+    std::shared_ptr<const Title> findTitle(const std::string& manifest_path) const;
+    std::shared_ptr<Title> copyTitle(size_t slot) const;
+    size_t claimSlot(const std::string& manifest_path);
+    void releaseSlot(size_t slot);
+    void touch(const Slot& slot) const;
+    static LadderId makeId(const Title& title);
+
+    const size_t max_titles;
+    std::unique_ptr<Slot[]> slots;  // max_titles slots, never moved
+    std::atomic<std::shared_ptr<const TitleIndex>> index;
+
+    // Held by writers only
+    std::mutex write_mutex;
+    std::vector<size_t> free_slots;
 };
 
 #endif  // BITRATE_MANAGER_HPP
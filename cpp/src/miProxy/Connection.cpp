@@ -1,19 +1,53 @@
 #include "Proxy.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
 #include <iostream>
 #include "spdlog/spdlog.h"
 
 // Constructor (updated)
 ClientConnection::ClientConnection(const std::string& manifest_path)
-    : current_throughput(0.0), manifest_path(manifest_path) {}
+    : session(std::make_shared<PlayerSession>()), client_addr{}, web_sock(-1), web_sock_connecting(false),
+      relay_pipe{-1, -1}, relay_pipe_size(0) {
+    session->manifest_path = manifest_path;
+}
+
+const in_addr& ClientConnection::getClientAddress() const {
+    return client_addr;
+}
+
+void ClientConnection::setClientAddress(const in_addr& addr) {
+    client_addr = addr;
+}
 
 // Getter for manifest path
-const std::string& ClientConnection::getManifestPath() const {
-    return manifest_path;
+std::string ClientConnection::getManifestPath() const {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->manifest_path;
 }
 
 // Setter for manifest path
 void ClientConnection::setManifestPath(const std::string& path) {
-    manifest_path = path;
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->manifest_path = path;
+}
+
+bool ClientConnection::hasManifest() const {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return !session->manifest_path.empty();
+}
+
+void ClientConnection::setLadder(BitrateManager::LadderId ladder) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->ladder = ladder;
+}
+
+const SessionTable::Session& ClientConnection::getSession() const {
+    return session;
+}
+
+void ClientConnection::setSession(SessionTable::Session new_session) {
+    session = std::move(new_session);
 }
 
 // Get the server IP address
@@ -23,36 +57,88 @@ void ClientConnection::setManifestPath(const std::string& path) {
 
 // Get the current throughput
 double ClientConnection::getCurrentThroughput() const {
-    return current_throughput;
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->throughput;
 }
 
 // Update the moving average throughput using EWMA
 void ClientConnection::updateThroughput(double new_throughput, double alpha) {
-    current_throughput = alpha * new_throughput + (1 - alpha) * current_throughput;
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->throughput = alpha * new_throughput + (1 - alpha) * session->throughput;
+}
+
+void ClientConnection::recordFragment(size_t bytes, double duration, double alpha) {
+    if (duration <= 0) return;
+    double sample = calculate_throughput(bytes, duration);
+    std::lock_guard<std::mutex> lock(session->mutex);
+    double& estimate = session->player_throughput;
+    estimate = estimate > 0 ? alpha * sample + (1 - alpha) * estimate : sample;
 }
 
-int ClientConnection::selectBitrate(Proxy& proxy) const {
-    // Use the proxy's BitrateManager to get the available bitrates for the current manifest path
-    const std::vector<int>* bitrates = proxy.getBitrateManager().getBitrates(manifest_path);
+double ClientConnection::getPlayerThroughput() const {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->player_throughput;
+}
+
+int ClientConnection::selectBitrate(const BitrateManager& bitrate_manager, const AbrPolicy& policy,
+                                    TimePoint now) const {
+    PlayerState player;
+    BitrateManager::LadderId ladder;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        ladder = session->ladder;
+        player.throughput = session->player_throughput > 0
+                                ? std::min(session->throughput, session->player_throughput)
+                                : session->throughput;
+        player.buffer_level = bufferLevelAt(now);
+        player.segment_duration = session->segment_duration;
+    }
+
+    // Use the BitrateManager to get the available bitrates for the current manifest
+    BitrateManager::Ladder bitrates = bitrate_manager.getBitrates(ladder);
     if (bitrates == nullptr) {
+        // the title was evicted and parsed again since the id was taken; look it up by path
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->manifest_path.empty()) return 0;
+        session->ladder = bitrate_manager.findLadder(session->manifest_path);
+        bitrates = bitrate_manager.getBitrates(session->ladder);
+    }
+    if (bitrates == nullptr || bitrates->bitrates.empty()) {
         // If no bitrates are found, return 0
         return 0;
     }
+    return select_bitrate(policy, *bitrates, player);
+}
 
-    // Iterate over the available bitrates in descending order to find the highest supported bitrate
-    for (auto rit = bitrates->rbegin(); rit != bitrates->rend(); ++rit) {
-        if (current_throughput >= 1.5 * (*rit)) {
-            return *rit;
-        }
-    }
+void ClientConnection::addBufferedSegment(bool reported_by_beacon, TimePoint now) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (session->beacons_seen && !reported_by_beacon) return;
+    session->beacons_seen = session->beacons_seen || reported_by_beacon;
+    session->buffer_level = bufferLevelAt(now) + session->segment_duration;
+    session->buffer_updated = now;
+}
+
+double ClientConnection::getBufferLevel(TimePoint now) const {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return bufferLevelAt(now);
+}
 
-    // If no suitable bitrate is found, return the lowest one
-    return bitrates->front();
+// Buffer level with the session locked by the caller
+double ClientConnection::bufferLevelAt(TimePoint now) const {
+    if (session->buffer_level <= 0) return 0.0;
+    return std::max(0.0, session->buffer_level - calculate_duration(session->buffer_updated, now));
+}
+
+void ClientConnection::setSegmentDuration(double seconds) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (seconds > 0) session->segment_duration = seconds;
 }
 
 // Add a new client connection
-void ConnectionManager::addClient(int client_fd) {
-    client_map.emplace(client_fd, ClientConnection(""));
+void ConnectionManager::addClient(int client_fd, const in_addr& client_addr, double initial_throughput) {
+    auto it = client_map.emplace(client_fd, ClientConnection("")).first;
+    it->second.setClientAddress(client_addr);
+    it->second.updateThroughput(initial_throughput, 1.0);  // the whole weight on the prior
 }
 
 // Update the throughput for a specific client
@@ -95,13 +181,85 @@ void ConnectionManager::removeClient(int client_fd) {
     spdlog::debug("Removed client {}", client_fd);
 }
 
-// int ClientConnection::getWebSock() const {
-//     return web_sock;
-// }
+int ClientConnection::getWebSock() const {
+    return web_sock;
+}
 
-// void ClientConnection::setWebSock(int webSockfd) {
-//     web_sock = webSockfd;
-// }
+void ClientConnection::setWebSock(int webSockfd) {
+    web_sock = webSockfd;
+}
+
+bool ClientConnection::isWebSockConnecting() const {
+    return web_sock_connecting;
+}
+
+void ClientConnection::setWebSockConnecting(bool connecting) {
+    web_sock_connecting = connecting;
+}
+
+HttpExchange& ClientConnection::getExchange() {
+    return exchange;
+}
+
+const int* ClientConnection::getRelayPipe() {
+#ifdef __linux__
+    if (relay_pipe[0] < 0) {
+        if (pipe2(relay_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+            relay_pipe[0] = relay_pipe[1] = -1;
+            return nullptr;
+        }
+        // a bigger pipe means fewer wakeups per segment; keep the default if refused
+        fcntl(relay_pipe[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+        int size = fcntl(relay_pipe[1], F_GETPIPE_SZ);
+        relay_pipe_size = size > 0 ? static_cast<size_t>(size) : 0;
+    }
+    return relay_pipe;
+#else
+    return nullptr;
+#endif
+}
+
+size_t ClientConnection::getRelayPipeSize() const {
+    return relay_pipe_size;
+}
+
+void ClientConnection::closeRelayPipe() {
+    if (relay_pipe[0] >= 0) close(relay_pipe[0]);
+    if (relay_pipe[1] >= 0) close(relay_pipe[1]);
+    relay_pipe[0] = relay_pipe[1] = -1;
+    relay_pipe_size = 0;
+}
+
+void ClientConnection::storePrefetched(const std::string& uri, SegmentCache::Entry response) {
+    prefetched[uri] = {std::move(response), get_current_time()};
+}
+
+SegmentCache::Entry ClientConnection::takePrefetched(const std::string& uri) {
+    auto it = prefetched.find(uri);
+    if (it == prefetched.end()) return nullptr;
+    SegmentCache::Entry response = std::move(it->second.response);
+    prefetched.erase(it);
+    return response;
+}
+
+bool ClientConnection::hasPrefetched(const std::string& uri) const {
+    return prefetched.count(uri) > 0;
+}
+
+size_t ClientConnection::dropPrefetched(double max_age, uint64_t& dropped) {
+    TimePoint now = get_current_time();
+    size_t bytes = 0;
+    for (auto it = prefetched.begin(); it != prefetched.end();) {
+        if (max_age >= 0 && calculate_duration(it->second.stored_at, now) <= max_age) {
+            ++it;
+            continue;
+        }
+        bytes += it->second.response->size();
+        ++dropped;
+        it = prefetched.erase(it);
+    }
+    return bytes;
+}
 
 const std::map<int, ClientConnection> & ConnectionManager::getClientMap() const {
     return client_map;
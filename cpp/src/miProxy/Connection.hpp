@@ -1,13 +1,21 @@
 #ifndef CONNECTION_HPP
 #define CONNECTION_HPP
 
-#include "Proxy.hpp"
+#include "Abr.hpp"
+#include "BitrateManager.hpp"
+#include "HttpExchange.hpp"
+#include "PlayerSession.hpp"
+#include "SegmentCache.hpp"
+#include <netinet/in.h>
 #include <map>
 #include <string>
 #include <vector>
 
 class Proxy;
 
+// Requested capacity of the pipe used to splice() segment bodies
+constexpr int RELAY_PIPE_SIZE = 256 * 1024;
+
 class ClientConnection {
 public:
     // Constructor
@@ -20,28 +28,88 @@ public:
     // Update the moving average throughput
     void updateThroughput(double new_throughput, double alpha);
 
-    // Select the highest supported bitrate based on current throughput
-    int selectBitrate(Proxy& proxy) const;
+    // Throughput the player measured for a segment it received (from its beacon). The
+    // first report is taken as it is; later ones are averaged like the proxy's own samples.
+    void recordFragment(size_t bytes, double duration, double alpha);
+    double getPlayerThroughput() const;
+
+    // Select the bitrate of the next segment from the ladder of the client's manifest.
+    // Once the player reports its own throughput, the lower of that and the proxy's
+    // estimate counts: the player's includes the path from the proxy to it.
+    int selectBitrate(const BitrateManager& bitrate_manager, const AbrPolicy& policy, TimePoint now) const;
+
+    // Estimated seconds of video the player has buffered. A segment reaching the player
+    // adds one segment duration; playback drains it in real time. Once the player sends
+    // /on-fragment-received beacons, they alone report its segments.
+    void addBufferedSegment(bool reported_by_beacon, TimePoint now);
+    double getBufferLevel(TimePoint now) const;
+    void setSegmentDuration(double seconds);
+
+    // Address the client connected from
+    const in_addr& getClientAddress() const;
+    void setClientAddress(const in_addr& addr);
 
     // Getters and setters for manifest path
-    const std::string& getManifestPath() const;
+    std::string getManifestPath() const;
     void setManifestPath(const std::string& path);
+    bool hasManifest() const;
+
+    // Ladder id of the manifest, so bitrate selection skips the path lookup
+    void setLadder(BitrateManager::LadderId ladder);
+
+    // Player session holding the ABR state above; a connection starts with one of its own
+    const SessionTable::Session& getSession() const;
+    void setSession(SessionTable::Session new_session);
 
     // getters and setters for web_sockfd
-    // int getWebSock() const;
-    // void setWebSock(int webSockfds);
+    int getWebSock() const;
+    void setWebSock(int webSockfd);
+
+    // whether the non-blocking connect on web_sock is still in progress
+    bool isWebSockConnecting() const;
+    void setWebSockConnecting(bool connecting);
+
+    // Request/response state machine for this connection
+    HttpExchange& getExchange();
+
+    // Pipe used to splice() bodies from the web socket to the client socket,
+    // created on first use; nullptr if it cannot be created
+    const int* getRelayPipe();
+    size_t getRelayPipeSize() const;
+    void closeRelayPipe();
+
+    // Segments prefetched for this client, kept until it asks for them
+    void storePrefetched(const std::string& uri, SegmentCache::Entry response);
+    SegmentCache::Entry takePrefetched(const std::string& uri);
+    bool hasPrefetched(const std::string& uri) const;
+
+    // Drop prefetched segments stored more than max_age seconds ago (all if max_age < 0);
+    // returns the bytes dropped and adds the number of segments to dropped
+    size_t dropPrefetched(double max_age, uint64_t& dropped);
 
 private:
+    double bufferLevelAt(TimePoint now) const;
+
+    struct PrefetchedSegment {
+        SegmentCache::Entry response;  // Complete response header and body
+        TimePoint stored_at;           // When the prefetch completed
+    };
+
     // std::string server_ip;          // IP address of the server the client is connected to
-    double current_throughput;      // Current estimated throughput (moving average)
-    std::string manifest_path;       // New member to store the manifest path
-    // int web_sock;                   // Web socket that client is connected to
+    SessionTable::Session session;  // Manifest, throughput and buffer state of the player
+    in_addr client_addr;            // Address the client connected from
+    int web_sock;                   // Web socket that client is connected to (-1 if none)
+    bool web_sock_connecting;       // True until the web socket's connect() completes
+    HttpExchange exchange;          // Exchange currently in flight on this connection
+    int relay_pipe[2];              // Read/write ends of the splice pipe (-1 until created)
+    size_t relay_pipe_size;         // Capacity of the splice pipe in bytes
+    std::map<std::string, PrefetchedSegment> prefetched;  // Prefetched segments by URI
 };
 
 class ConnectionManager {
 public:
-    // Add a new client connection
-    void addClient(int client_fd);
+    // Add a new client connection from client_addr, with a throughput estimate to start from
+    void addClient(int client_fd, const in_addr& client_addr, double initial_throughput);
 
     // Update the throughput for a specific client
     void updateClientThroughput(int client_fd, double new_throughput, double alpha);
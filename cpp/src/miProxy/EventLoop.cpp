@@ -0,0 +1,83 @@
+#include "EventLoop.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include "spdlog/spdlog.h"
+
+// Max number of ready events collected by a single epoll_wait
+constexpr int MAX_READY_EVENTS = 256;
+
+// Constructor
+EventLoop::EventLoop() : ready(MAX_READY_EVENTS) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Destructor
+EventLoop::~EventLoop() {
+    close(epoll_fd);
+}
+
+void EventLoop::add(int fd, uint32_t events, Handler handler) {
+    struct epoll_event ev {};
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        spdlog::error("epoll_ctl ADD failed for fd {}", fd);
+        return;
+    }
+    handlers[fd] = std::move(handler);
+}
+
+void EventLoop::modify(int fd, uint32_t events) {
+    struct epoll_event ev {};
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        spdlog::error("epoll_ctl MOD failed for fd {}", fd);
+    }
+}
+
+void EventLoop::setHandler(int fd, Handler handler) {
+    auto it = handlers.find(fd);
+    if (it != handlers.end()) it->second = std::move(handler);
+}
+
+void EventLoop::remove(int fd) {
+    if (handlers.erase(fd) == 0) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int EventLoop::poll(int timeout_ms) {
+    int n = epoll_wait(epoll_fd, ready.data(), static_cast<int>(ready.size()), timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR) perror("epoll_wait");
+        return 0;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        // A handler earlier in this batch may have removed this fd
+        auto it = handlers.find(ready[i].data.fd);
+        if (it == handlers.end()) continue;
+
+        // Copy the handler so it may safely remove its own registration
+        Handler handler = it->second;
+        handler(ready[i].events);
+    }
+    return n;
+}
+
+size_t EventLoop::getNumWatched() const {
+    return handlers.size();
+}
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
@@ -0,0 +1,53 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <sys/epoll.h>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// Edge-triggered epoll reactor. Each fd is registered once with a handler and
+// only fds that are actually ready are visited on a wakeup, so the cost of a
+// wakeup does not grow with the number of idle connections.
+class EventLoop {
+public:
+    // Called with the epoll event mask (EPOLLIN, EPOLLOUT, EPOLLERR, ...)
+    using Handler = std::function<void(uint32_t events)>;
+
+    // Constructor
+    EventLoop();
+
+    // Destructor
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Register fd for the given events; EPOLLET is always added
+    void add(int fd, uint32_t events, Handler handler);
+
+    // Change the events an already registered fd is interested in
+    void modify(int fd, uint32_t events);
+
+    // Route the events of an already registered fd to a different handler
+    void setHandler(int fd, Handler handler);
+
+    // Stop watching fd (must be called before the fd is closed)
+    void remove(int fd);
+
+    // Wait up to timeout_ms for events and dispatch them; returns the number of ready fds
+    int poll(int timeout_ms);
+
+    size_t getNumWatched() const;
+
+private:
+    int epoll_fd;
+    std::unordered_map<int, Handler> handlers;  // Map of fd to its event handler
+    std::vector<struct epoll_event> ready;      // Scratch array filled by epoll_wait
+};
+
+// Put fd into non-blocking mode; returns false on failure
+bool set_nonblocking(int fd);
+
+#endif  // EVENT_LOOP_HPP
@@ -0,0 +1,76 @@
+#include "HttpBuffer.hpp"
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
+
+ssize_t HttpBuffer::readOnce(int fd, size_t max_bytes) {
+    reserveTail(max_bytes);
+    ssize_t bytes_read = recv(fd, buffer.data() + end, max_bytes, 0);
+    if (bytes_read > 0) end += static_cast<size_t>(bytes_read);
+    return bytes_read;
+}
+
+void HttpBuffer::append(const char* data, size_t len) {
+    reserveTail(len);
+    memcpy(buffer.data() + end, data, len);
+    end += len;
+}
+
+size_t HttpBuffer::findHeaderEnd() {
+    // resume where the last scan stopped, backing up in case "\r\n\r\n" straddles reads
+    size_t from = std::max(start, scanned >= 3 ? scanned - 3 : 0);
+    if (end - from >= 4) {
+        const void* found = memmem(buffer.data() + from, end - from, "\r\n\r\n", 4);
+        if (found != nullptr) {
+            return static_cast<const char*>(found) - (buffer.data() + start) + 4;
+        }
+    }
+    scanned = end;
+    return 0;
+}
+
+const char* HttpBuffer::data() const {
+    return buffer.data() + start;
+}
+
+size_t HttpBuffer::size() const {
+    return end - start;
+}
+
+bool HttpBuffer::empty() const {
+    return start == end;
+}
+
+std::string_view HttpBuffer::view() const {
+    return std::string_view(buffer.data() + start, end - start);
+}
+
+void HttpBuffer::consume(size_t n) {
+    start += std::min(n, end - start);
+    scanned = std::max(scanned, start);
+    if (start == end) start = end = scanned = 0;
+}
+
+std::string HttpBuffer::take(size_t n) {
+    n = std::min(n, end - start);
+    std::string out(buffer.data() + start, n);
+    consume(n);
+    return out;
+}
+
+void HttpBuffer::clear() {
+    start = end = scanned = 0;
+}
+
+void HttpBuffer::reserveTail(size_t n) {
+    if (buffer.size() - end >= n) return;
+
+    // slide unconsumed bytes to the front before growing
+    if (start > 0) {
+        memmove(buffer.data(), buffer.data() + start, end - start);
+        end -= start;
+        scanned -= std::min(scanned, start);
+        start = 0;
+    }
+    if (buffer.size() - end < n) buffer.resize(std::max(buffer.size() * 2, end + n));
+}
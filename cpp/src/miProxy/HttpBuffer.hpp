@@ -0,0 +1,51 @@
+#ifndef HTTP_BUFFER_HPP
+#define HTTP_BUFFER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+
+// Per-connection input buffer. Reads from a socket in large slices, finds the end
+// of an HTTP header without rescanning bytes it has already looked at, and keeps
+// whatever follows the header (body bytes, the next request) for the caller.
+class HttpBuffer {
+public:
+    // Size of a single read into the buffer
+    static constexpr size_t READ_SLICE = 16 * 1024;
+
+    // One recv() of up to max_bytes appended to the buffer; returns like recv()
+    ssize_t readOnce(int fd, size_t max_bytes = READ_SLICE);
+
+    // Append bytes that were read elsewhere
+    void append(const char* data, size_t len);
+
+    // Length of the header at the front of the buffer, including the blank line,
+    // or 0 if the header is not complete yet
+    size_t findHeaderEnd();
+
+    // Unconsumed bytes
+    const char* data() const;
+    size_t size() const;
+    bool empty() const;
+    std::string_view view() const;
+
+    // Drop n bytes from the front
+    void consume(size_t n);
+
+    // Move the first n bytes out as a string
+    std::string take(size_t n);
+
+    void clear();
+
+private:
+    // Make room for at least n more bytes at the back
+    void reserveTail(size_t n);
+
+    std::vector<char> buffer;
+    size_t start = 0;    // First unconsumed byte
+    size_t end = 0;      // One past the last valid byte
+    size_t scanned = 0;  // Bytes before this index hold no header terminator start
+};
+
+#endif  // HTTP_BUFFER_HPP
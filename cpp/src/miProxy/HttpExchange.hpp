@@ -0,0 +1,131 @@
+#ifndef HTTP_EXCHANGE_HPP
+#define HTTP_EXCHANGE_HPP
+
+#include "common.hpp"
+#include "BitrateManager.hpp"
+#include "HttpBuffer.hpp"
+#include "HttpRequest.hpp"
+#include "RequestPhases.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Where a client connection is in its current request/response exchange
+enum class ExchangeState {
+    ReadingRequest,          // Waiting for a complete request from the client
+    AwaitingUpstreamHeader,  // Request forwarded, waiting for the web server's response header
+    RelayingBody,            // Receiving the response body from the web server (and relaying it)
+    WritingResponse,         // Sending the response back to the client
+    FollowingFetch           // Relaying another client's fetch of the same segment
+};
+
+// How the proxy treats the request currently in flight
+enum class RequestKind {
+    Manifest,        // Full .mpd; the player gets the "-no-list" form built from it
+    Segment,         // .m4s video segment with a rewritten bitrate
+    Beacon,          // POST /on-fragment-received from the player, answered by the proxy
+    PassThrough      // Everything else, forwarded as-is
+};
+
+// A segment fetch that clients asking for the same URI at the same time attach to, so
+// the web server sees one request per segment rather than one per viewer
+struct SegmentFlight {
+    std::string data;            // Response header and body received so far
+    size_t total = 0;            // Full response length, known once the header arrived
+    bool failed = false;         // Fetch abandoned; followers fetch for themselves
+    std::vector<int> followers;  // Client sockets reading along (some may have moved on)
+    int prefetch_client = -1;    // Client a prefetch runs for; -1 for a player's own fetch
+    bool prefetch_claimed = false;  // That client asked for the segment before it arrived
+};
+
+// Per-connection state machine driven by the Proxy's event loop. One exchange
+// is in flight per client connection; many connections overlap on one thread.
+struct HttpExchange {
+    ExchangeState state = ExchangeState::ReadingRequest;
+    RequestKind kind = RequestKind::PassThrough;
+
+    HttpBuffer request_buffer;     // Bytes received from the client not yet handled
+    HttpRequestParser request_parser;  // Parses the request at the front of request_buffer
+    std::string upstream_request;  // Request being forwarded to the web server
+    size_t upstream_sent = 0;      // Bytes of upstream_request already written
+
+    HttpBuffer upstream_in;        // Bytes from the web server while the response header is incomplete
+    std::string response_header;   // Response header from the web server
+    std::vector<char> body;        // Response body, when buffered rather than relayed (manifests)
+    size_t content_length = 0;     // Body length announced by the web server
+    size_t body_received = 0;      // Body bytes received from the web server so far
+    bool relay = false;            // Body is streamed to the client as it arrives
+    bool relay_paused = false;     // Reading from the web server paused for backpressure
+    bool splicing = false;         // Body moves through the relay pipe instead of user space
+    size_t pipe_bytes = 0;         // Body bytes sitting in the relay pipe
+
+    std::string response;          // Bytes queued for the client
+    size_t response_sent = 0;      // Bytes of response already written
+    std::shared_ptr<const std::string> cached_response;  // Segment cache entry being written instead
+    size_t cached_sent = 0;        // Bytes of cached_response already written
+    std::shared_ptr<SegmentFlight> flight;  // Shared segment fetch this exchange leads or follows
+    bool flight_leader = false;    // This exchange's web socket feeds the flight
+    size_t flight_sent = 0;        // Bytes of flight->data already written (followers)
+    bool client_gone = false;      // Client failed mid-fetch; the fetch goes on for the followers
+
+    BitrateManager::Manifest stale_manifest;  // Expired manifest being revalidated with the web server
+
+    std::string uri;               // URI forwarded upstream (rewritten for segments)
+    int bitrate = 0;               // Bitrate selected for a segment request
+    RequestPhases phases;          // When each phase of a segment fetch ended
+    bool log_pending = false;      // Segment fetched; its chunk log line waits for the client to have it
+    TcpRateMark tcp_mark;          // Web socket's TCP_INFO once the segment's response header arrived
+
+    bool upstream_reused = false;  // Request went out on a pooled keep-alive connection
+    int upstream_attempts = 0;     // Connects/retries made for this request
+    bool close_after = false;      // Client asked for the connection to close after this response
+
+    // Connection-wide; kept across requests
+    bool client_eof = false;          // Client finished sending; close once its requests are answered
+    bool client_read_paused = false;  // Reading from the client paused, too many pipelined bytes queued
+
+    // Bytes accepted from the web server but not yet written to the client
+    size_t pendingBytes() const {
+        size_t cached = cached_response ? cached_response->size() - cached_sent : 0;
+        size_t followed = flight && !flight_leader ? flight->data.size() - flight_sent : 0;
+        return response.size() - response_sent + cached + followed + pipe_bytes;
+    }
+
+    // Prepare for the next request, keeping any bytes the client already sent and the
+    // connection-wide flags
+    void reset() {
+        state = ExchangeState::ReadingRequest;
+        kind = RequestKind::PassThrough;
+        request_parser.reset();
+        upstream_request.clear();
+        upstream_sent = 0;
+        upstream_in.clear();
+        response_header.clear();
+        body.clear();
+        content_length = 0;
+        body_received = 0;
+        relay = false;
+        relay_paused = false;
+        splicing = false;
+        pipe_bytes = 0;
+        response.clear();
+        response_sent = 0;
+        cached_response.reset();
+        cached_sent = 0;
+        flight.reset();
+        flight_leader = false;
+        flight_sent = 0;
+        client_gone = false;
+        stale_manifest.reset();
+        uri.clear();
+        bitrate = 0;
+        phases = RequestPhases();
+        log_pending = false;
+        tcp_mark = TcpRateMark();
+        upstream_reused = false;
+        upstream_attempts = 0;
+        close_after = false;
+    }
+};
+
+#endif  // HTTP_EXCHANGE_HPP
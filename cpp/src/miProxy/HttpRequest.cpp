@@ -0,0 +1,199 @@
+#include "HttpRequest.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+bool iequals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char ch1, char ch2) {
+               return std::tolower(static_cast<unsigned char>(ch1)) == std::tolower(static_cast<unsigned char>(ch2));
+           });
+}
+
+bool is_space(char ch) {
+    return ch == ' ' || ch == '\t';
+}
+
+// The edit overwriting this field, if any
+const HttpHeaderField* find_set(const HttpHeaderField& field, std::span<const HttpHeaderField> set) {
+    for (const HttpHeaderField& edit : set) {
+        if (field.is(edit.name)) return &edit;
+    }
+    return nullptr;
+}
+
+bool is_dropped(const HttpHeaderField& field, std::span<const std::string_view> drop) {
+    return std::any_of(drop.begin(), drop.end(), [&](std::string_view name) { return field.is(name); });
+}
+
+char* put(char* dest, std::string_view text) {
+    memcpy(dest, text.data(), text.size());
+    return dest + text.size();
+}
+
+}  // namespace
+
+bool HttpHeaderField::is(std::string_view field_name) const {
+    return iequals(name, field_name);
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+    for (const HttpHeaderField& field : headers) {
+        if (field.is(name)) return field.value;
+    }
+    return {};
+}
+
+bool HttpRequest::hasHeader(std::string_view name) const {
+    return std::any_of(headers.begin(), headers.end(),
+                       [&](const HttpHeaderField& field) { return field.is(name); });
+}
+
+ParseResult HttpRequestParser::parse(std::string_view input) {
+    // the header is done; only refresh the views, since the bytes may have moved
+    if (complete) return finish(input);
+
+    while (true) {
+        size_t line_end = input.find('\n', std::max(offset, scanned));
+        if (line_end == std::string_view::npos) {
+            scanned = input.size();
+            return scanned > MAX_REQUEST_HEADER_SIZE ? ParseResult::Invalid : ParseResult::Incomplete;
+        }
+
+        // accept a bare LF as well as CRLF
+        size_t line_start = offset;
+        std::string_view line = input.substr(line_start, line_end - line_start);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        offset = scanned = line_end + 1;
+
+        ParseResult result;
+        if (!have_request_line) {
+            // empty lines before the request line are ignored
+            if (line.empty()) continue;
+            result = parseRequestLine(line, line_start);
+        } else if (line.empty()) {
+            return finish(input);
+        } else {
+            result = parseHeaderLine(line, line_start);
+        }
+        if (result != ParseResult::Incomplete) return result;
+    }
+}
+
+const HttpRequest& HttpRequestParser::request() const {
+    return parsed;
+}
+
+void HttpRequestParser::reset() {
+    offset = 0;
+    scanned = 0;
+    have_request_line = false;
+    complete = false;
+    fields.clear();
+}
+
+// "METHOD SP request-target SP HTTP-version"
+ParseResult HttpRequestParser::parseRequestLine(std::string_view line, size_t line_start) {
+    size_t first_space = line.find(' ');
+    size_t second_space = first_space == std::string_view::npos ? first_space : line.find(' ', first_space + 1);
+    if (first_space == 0 || second_space == std::string_view::npos || second_space == first_space + 1 ||
+        line.find(' ', second_space + 1) != std::string_view::npos) {
+        return ParseResult::Invalid;
+    }
+    if (line.substr(second_space + 1, 5) != "HTTP/") return ParseResult::Invalid;
+
+    method = {line_start, first_space};
+    uri = {line_start + first_space + 1, second_space - first_space - 1};
+    version = {line_start + second_space + 1, line.size() - second_space - 1};
+    have_request_line = true;
+    return ParseResult::Incomplete;
+}
+
+// "field-name: OWS field-value OWS"
+ParseResult HttpRequestParser::parseHeaderLine(std::string_view line, size_t line_start) {
+    size_t colon = line.find(':');
+    // obsolete line folding and whitespace before the colon are rejected, as RFC 7230 allows
+    if (colon == 0 || colon == std::string_view::npos || is_space(line[0]) || is_space(line[colon - 1])) {
+        return ParseResult::Invalid;
+    }
+
+    size_t value_start = colon + 1;
+    size_t value_end = line.size();
+    while (value_start < value_end && is_space(line[value_start])) ++value_start;
+    while (value_end > value_start && is_space(line[value_end - 1])) --value_end;
+
+    fields.push_back({{line_start, colon}, {line_start + value_start, value_end - value_start}});
+    return ParseResult::Incomplete;
+}
+
+size_t rewrite_request(const HttpRequest& request, const RequestEdits& edits, std::string& out) {
+    std::string_view uri = edits.uri.empty() ? request.uri : edits.uri;
+    auto value_of = [&](const HttpHeaderField& field) {
+        const HttpHeaderField* edit = find_set(field, edits.set);
+        return edit ? edit->value : field.value;
+    };
+    auto is_added = [&](const HttpHeaderField& edit) {
+        return std::none_of(request.headers.begin(), request.headers.end(), [&](const HttpHeaderField& field) {
+            return field.is(edit.name) && !is_dropped(field, edits.drop);
+        });
+    };
+
+    // size the output first: request line, surviving fields, added fields, blank line
+    size_t size = request.method.size() + uri.size() + request.version.size() + 4;
+    for (const HttpHeaderField& field : request.headers) {
+        if (!is_dropped(field, edits.drop)) size += field.name.size() + value_of(field).size() + 4;
+    }
+    for (const HttpHeaderField& edit : edits.set) {
+        if (is_added(edit)) size += edit.name.size() + edit.value.size() + 4;
+    }
+    size += 2;
+
+    out.resize(size);
+    char* dest = out.data();
+    auto put_field = [&](std::string_view name, std::string_view value) {
+        dest = put(put(put(put(dest, name), ": "), value), "\r\n");
+    };
+    dest = put(put(put(put(put(put(dest, request.method), " "), uri), " "), request.version), "\r\n");
+    for (const HttpHeaderField& field : request.headers) {
+        if (!is_dropped(field, edits.drop)) put_field(field.name, value_of(field));
+    }
+    for (const HttpHeaderField& edit : edits.set) {
+        if (is_added(edit)) put_field(edit.name, edit.value);
+    }
+    put(dest, "\r\n");
+    return size;
+}
+
+// Materialize the views now that the header is final, and work out how the request is framed
+ParseResult HttpRequestParser::finish(std::string_view input) {
+    auto view = [&](const Span& span) { return input.substr(span.pos, span.len); };
+    parsed.method = view(method);
+    parsed.uri = view(uri);
+    parsed.version = view(version);
+    parsed.headers.clear();
+    parsed.headers.reserve(fields.size());
+    for (const auto& [name, value] : fields) parsed.headers.push_back({view(name), view(value)});
+    parsed.header_length = offset;
+
+    // chunked request bodies are not supported; the proxy needs the body length up front
+    if (parsed.hasHeader("Transfer-Encoding")) return ParseResult::Invalid;
+    parsed.content_length = 0;
+    std::string_view length = parsed.header("Content-Length");
+    if (!length.empty()) {
+        auto [end, error] = std::from_chars(length.data(), length.data() + length.size(), parsed.content_length);
+        if (error != std::errc() || end != length.data() + length.size()) return ParseResult::Invalid;
+    }
+
+    // HTTP/1.1 connections persist unless closed explicitly; HTTP/1.0 ones only on request
+    std::string_view connection = parsed.header("Connection");
+    if (parsed.version == "HTTP/1.0") {
+        parsed.keep_alive = iequals(connection, "keep-alive");
+    } else {
+        parsed.keep_alive = !iequals(connection, "close");
+    }
+
+    complete = true;
+    return ParseResult::Complete;
+}
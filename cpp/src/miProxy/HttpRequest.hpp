@@ -0,0 +1,90 @@
+#ifndef HTTP_REQUEST_HPP
+#define HTTP_REQUEST_HPP
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Requests whose header grows past this without ending are rejected
+constexpr size_t MAX_REQUEST_HEADER_SIZE = 64 * 1024;
+
+struct HttpHeaderField {
+    std::string_view name;
+    std::string_view value;  // Without surrounding whitespace
+
+    // Whether this field has the given name (case-insensitive)
+    bool is(std::string_view field_name) const;
+};
+
+// Request line and header fields of one HTTP/1.1 request, as views into the buffer
+// the request was parsed from. Only valid while that buffer is left untouched.
+struct HttpRequest {
+    std::string_view method;
+    std::string_view uri;
+    std::string_view version;
+    std::vector<HttpHeaderField> headers;
+    size_t header_length = 0;  // Bytes up to and including the blank line
+    size_t content_length = 0; // Body bytes following the header
+    bool keep_alive = true;    // Connection stays open after the response
+
+    // Value of the named header (case-insensitive); empty if absent
+    std::string_view header(std::string_view name) const;
+    bool hasHeader(std::string_view name) const;
+};
+
+enum class ParseResult {
+    Complete,    // The whole header has been parsed
+    Incomplete,  // More bytes are needed
+    Invalid      // Not an HTTP request, or one the proxy cannot frame
+};
+
+// Incremental request header parser. Each call gets everything buffered so far for
+// the current request (starting at the same byte every time, though the bytes may
+// have moved in memory) and resumes at the line where the previous call stopped.
+class HttpRequestParser {
+public:
+    // Once the header is complete, further calls (while the body arrives) only point
+    // the views at the current input and return Complete again.
+    ParseResult parse(std::string_view input);
+
+    // The parsed request; valid after parse() returned Complete
+    const HttpRequest& request() const;
+
+    // Start over for the next request
+    void reset();
+
+private:
+    // Field positions are kept as offsets while parsing, because the input may be
+    // compacted or reallocated between calls
+    struct Span {
+        size_t pos = 0;
+        size_t len = 0;
+    };
+
+    ParseResult parseRequestLine(std::string_view line, size_t line_start);
+    ParseResult parseHeaderLine(std::string_view line, size_t line_start);
+    ParseResult finish(std::string_view input);
+
+    size_t offset = 0;   // Start of the first line not parsed yet
+    size_t scanned = 0;  // Bytes already searched for the end of that line
+    bool have_request_line = false;
+    bool complete = false;
+    Span method, uri, version;
+    std::vector<std::pair<Span, Span>> fields;
+    HttpRequest parsed;
+};
+
+// Changes rewrite_request applies while copying a request header
+struct RequestEdits {
+    std::string_view uri = {};                    // New request-target; empty keeps the original
+    std::span<const HttpHeaderField> set = {};    // Fields to overwrite, appended when the request lacks them
+    std::span<const std::string_view> drop = {};  // Fields to leave out
+};
+
+// Writes the edited request header into out, replacing its contents. The output size
+// is computed first so the header is emitted with a single allocation and no copies
+// of intermediate strings. Returns the header length.
+size_t rewrite_request(const HttpRequest& request, const RequestEdits& edits, std::string& out);
+
+#endif  // HTTP_REQUEST_HPP
@@ -0,0 +1,90 @@
+#include "PlayerSession.hpp"
+#include <algorithm>
+
+// Constructor
+SessionTable::SessionTable(double idle_timeout) : idle_timeout(idle_timeout), last_sweep(get_current_time()) {}
+
+bool SessionTable::isEnabled() const {
+    return idle_timeout > 0;
+}
+
+SessionTable::Session SessionTable::attach(const in_addr& addr, const std::string& manifest_path,
+                                           const Session& current) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Entry>& entries = sessions[addr.s_addr];
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->session->manifest_path != manifest_path) continue;
+        // most recently joined last
+        Session session = it->session;
+        std::rotate(it, it + 1, entries.end());
+        return session;
+    }
+
+    Session session = current;
+    if (current->registered) {
+        // the player moved on to another video; its network did not change
+        session = std::make_shared<PlayerSession>();
+        std::lock_guard<std::mutex> current_lock(current->mutex);
+        session->throughput = current->throughput;
+        session->player_throughput = current->player_throughput;
+    }
+    {
+        std::lock_guard<std::mutex> session_lock(session->mutex);
+        session->manifest_path = manifest_path;
+    }
+    session->registered = true;
+    entries.push_back({session, TimePoint(), false});
+    ++count;
+    return session;
+}
+
+SessionTable::Session SessionTable::find(const in_addr& addr, const std::string& uri) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sessions.find(addr.s_addr);
+    if (it == sessions.end()) return nullptr;
+
+    for (auto entry = it->second.rbegin(); entry != it->second.rend(); ++entry) {
+        // listed sessions never change their manifest path
+        const std::string& manifest_path = entry->session->manifest_path;
+        std::string directory = manifest_path.substr(0, manifest_path.rfind('/') + 1);
+        if (uri.empty() || uri.compare(0, directory.size(), directory) == 0) return entry->session;
+    }
+    return nullptr;
+}
+
+size_t SessionTable::expireIdle(double interval) {
+    std::lock_guard<std::mutex> lock(mutex);
+    TimePoint now = get_current_time();
+    if (calculate_duration(last_sweep, now) < interval) return 0;
+    last_sweep = now;
+
+    size_t dropped = 0;
+    for (auto it = sessions.begin(); it != sessions.end();) {
+        std::vector<Entry>& entries = it->second;
+        for (Entry& entry : entries) {
+            // only the table holds it: no connection uses the session, and none can
+            // pick it up without this lock
+            if (entry.session.use_count() > 1) {
+                entry.idle = false;
+            } else if (!entry.idle) {
+                entry.idle = true;
+                entry.idle_since = now;
+            }
+        }
+        size_t before = entries.size();
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [&](const Entry& entry) {
+                                         return entry.idle && calculate_duration(entry.idle_since, now) >= idle_timeout;
+                                     }),
+                      entries.end());
+        dropped += before - entries.size();
+        it = entries.empty() ? sessions.erase(it) : std::next(it);
+    }
+    count -= dropped;
+    return dropped;
+}
+
+size_t SessionTable::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+}
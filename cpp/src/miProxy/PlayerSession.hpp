@@ -0,0 +1,72 @@
+#ifndef PLAYER_SESSION_HPP
+#define PLAYER_SESSION_HPP
+
+#include "common.hpp"
+#include "Abr.hpp"
+#include "BitrateManager.hpp"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ABR state of one player: what it streams, how fast its downloads go and how much it
+// has buffered. Browsers open new connections mid-playback, so the state lives here
+// rather than in a connection, and every connection of the player points at it.
+struct PlayerSession {
+    mutable std::mutex mutex;        // The player's connections may be handled by different workers
+    std::string manifest_path;       // Manifest the player streams ("" until it asked for one)
+    BitrateManager::LadderId ladder = BitrateManager::NO_LADDER;  // Ladder of manifest_path
+    double throughput = 0.0;         // Estimated throughput (moving average, Kbps)
+    double player_throughput = 0.0;  // Throughput the player reports in its beacons (moving average, Kbps)
+    double buffer_level = 0.0;       // Estimated buffer (seconds) as of buffer_updated
+    TimePoint buffer_updated;        // When buffer_level was last set
+    double segment_duration = DEFAULT_SEGMENT_DURATION;  // Seconds of video per segment
+    bool beacons_seen = false;       // The player reports the segments it received
+    bool registered = false;         // Listed in the SessionTable (guarded by the table's lock)
+};
+
+// Sessions of all players, keyed by client address and manifest, shared by all workers.
+// A connection joins its player's session when it asks for a manifest, or for a segment
+// or beacon before it did. Sessions no connection has used for idle_timeout are dropped.
+class SessionTable {
+public:
+    using Session = std::shared_ptr<PlayerSession>;
+
+    // Constructor; an idle_timeout of 0 disables the table
+    explicit SessionTable(double idle_timeout);
+
+    bool isEnabled() const;
+
+    // Session of the player at addr streaming manifest_path. Without one, the calling
+    // connection's current session becomes it (or a new session keeping its throughput,
+    // if that one is already listed under another manifest).
+    Session attach(const in_addr& addr, const std::string& manifest_path, const Session& current);
+
+    // Most recently joined session at addr whose manifest lies in the directory of uri,
+    // or at addr at all for an empty uri; nullptr if there is none
+    Session find(const in_addr& addr, const std::string& uri);
+
+    // Drop sessions without connections for idle_timeout seconds; sweeps at most once
+    // per interval however many workers call it. Returns the number of sessions dropped.
+    size_t expireIdle(double interval);
+
+    size_t size();
+
+private:
+    struct Entry {
+        Session session;
+        TimePoint idle_since;  // When the sweep first found the session without connections
+        bool idle = false;
+    };
+
+    const double idle_timeout;
+    std::mutex mutex;
+    std::unordered_map<uint32_t, std::vector<Entry>> sessions;  // By client address, oldest first
+    size_t count = 0;
+    TimePoint last_sweep;
+};
+
+#endif  // PLAYER_SESSION_HPP
@@ -0,0 +1,42 @@
+#ifndef PREFETCH_HPP
+#define PREFETCH_HPP
+
+#include "common.hpp"
+#include "HttpBuffer.hpp"
+#include "BitrateManager.hpp"
+#include "HttpExchange.hpp"
+#include "RequestPhases.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Counters describing how well prefetching predicts the players' requests
+struct PrefetchStats {
+    uint64_t issued = 0;         // Segments requested ahead of a player
+    uint64_t used = 0;           // Prefetched segments the player then asked for
+    uint64_t wasted = 0;         // Prefetched segments dropped unasked (expired, other bitrate, client left)
+    uint64_t failed = 0;         // Prefetches cut short or answered with an error
+    uint64_t bytes_fetched = 0;  // Response bytes received for prefetches
+    uint64_t bytes_used = 0;     // Of those, bytes the players asked for
+    uint64_t bytes_wasted = 0;   // Of those, bytes dropped unasked
+};
+
+// A segment fetched ahead of a player's request on a web server connection of its own.
+// The fetch leads a SegmentFlight, so a player asking for the segment before it has
+// arrived follows it like any other client; once complete, the response goes to the
+// player's prefetch store.
+struct PrefetchFetch {
+    int client_sock = -1;          // Player the segment is fetched for (-1 once it left)
+    std::string uri;               // Segment URI requested from the web server
+    int bitrate = 0;               // Bitrate in the URI
+    std::string request;           // Request written to the web server
+    size_t request_sent = 0;       // Bytes of request already written
+    bool connecting = false;       // True until the web socket's connect() completes
+    HttpBuffer in;                 // Response bytes while the header is incomplete
+    size_t content_length = 0;     // Body length announced by the web server
+    std::shared_ptr<SegmentFlight> flight;  // Response header and body, shared with followers
+    RequestPhases phases;          // When each phase of the fetch ended
+    TcpRateMark tcp_mark;          // Web socket's TCP_INFO once the response header arrived
+};
+
+#endif  // PREFETCH_HPP
@@ -4,16 +4,59 @@
 #include "Connection.hpp"
 #include "manifest_parser.hpp"
 #include "Logger.hpp"
+#include "network_utils.h"
 #include <array>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <charconv>
+#include "spdlog/spdlog.h"
 
-#define MAXCLIENTS 30
+// How long the event loop sleeps at most between housekeeping ticks
+constexpr int TICK_MS = 100;
+
+// Seconds between upstream pool counter reports
+constexpr double STATS_INTERVAL = 10.0;
+
+// Seconds between sweeps for idle player sessions
+constexpr double SESSION_SWEEP_INTERVAL = 1.0;
+
+// Reply to every /on-fragment-received beacon, shared by all clients
+static const SegmentCache::Entry BEACON_RESPONSE =
+    std::make_shared<const std::string>("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+
+// Connects/retries per request before the client gets a 502
+constexpr int MAX_UPSTREAM_ATTEMPTS = 3;
+
+// Relayed bodies move in slices of this size; reading from the web server pauses
+// once HIGH_WATER bytes are queued for the client and resumes below LOW_WATER
+constexpr size_t RELAY_SLICE_SIZE = 64 * 1024;
+constexpr size_t RELAY_HIGH_WATER = 256 * 1024;
+constexpr size_t RELAY_LOW_WATER = 64 * 1024;
+static_assert(HttpBuffer::READ_SLICE <= RELAY_SLICE_SIZE, "header leftovers must fit the scratch buffer");
+
+// Largest request body accepted from a client, and how many bytes of pipelined requests
+// are buffered ahead of the current exchange before reading from the client pauses
+constexpr size_t MAX_REQUEST_BODY_SIZE = 1024 * 1024;
+constexpr size_t MAX_PIPELINED_BYTES = 256 * 1024;
+
+// Largest segment response held in memory so concurrent requests can share one fetch
+constexpr size_t MAX_COALESCED_SIZE = 16 * 1024 * 1024;
+
+// Seconds a prefetched segment waits for its player before it is dropped as wasted
+constexpr double PREFETCH_TTL = 10.0;
+
+// spliceFromUpstream results besides a recv()-style byte count
+constexpr ssize_t SPLICE_PIPE_FULL = -2;
+constexpr ssize_t SPLICE_UNSUPPORTED = -3;
 /*
  *  Compile with: g++ --std=c++11 echo_server.cpp
  *  Try to run this server and run multiple instances
@@ -24,15 +67,36 @@
  */
 
 // Constructor
-Proxy::Proxy(int listen_port, const std::string& server_ip, int server_port, double alpha, Logger &logger)
-    : listen_port(listen_port), server_ip(server_ip), server_port(server_port), alpha(alpha), logger(logger) {
-        // open web socket
-        web_sock = openWebSock();
-    }
-
-// Destructor
+Proxy::Proxy(int listen_port, const std::string& server_ip, int server_port, double alpha, Logger &logger,
+             BitrateManager &bitrate_manager, SegmentCache &segment_cache, ThroughputPriors &throughput_priors,
+             SessionTable &session_table, const ProxyOptions &options)
+    : listen_port(listen_port),
+      server_ip(server_ip),
+      server_port(server_port),
+      alpha(alpha),
+      master_socket(-1),
+      logger(logger),
+      read_buffer(RELAY_SLICE_SIZE),
+      upstream_pool(event_loop, options.pool_size, options.pool_idle_timeout),
+      splice_enabled(options.splice),
+      bitrate_manager(bitrate_manager),
+      abr_policy(make_abr_policy(options.abr_policy).value_or(ThroughputPolicy{})),
+      segment_cache(segment_cache),
+      throughput_priors(throughput_priors),
+      session_table(session_table),
+      tcp_info_weight(options.tcp_info_weight),
+      log_phases(options.log_phases),
+      manifest_ttl(options.manifest_ttl),
+      prefetch_depth(options.prefetch_depth),
+      last_stats_time(get_current_time()) {}
+
+// Destructor (web sockets are closed by the upstream pool)
 Proxy::~Proxy() {
-    close(web_sock);
+    for (const auto& pair : connection_manager.getClientMap()) {
+        connection_manager.getClient(pair.first)->closeRelayPipe();
+        close(pair.first);
+    }
+    if (master_socket >= 0) close(master_socket);
 }
 
 // // Create a listening socket
@@ -70,9 +134,9 @@ Proxy::~Proxy() {
 //     return sockfd;
 // }
 
-// Add a new client and open new web socket
-void Proxy::addNewClient(int client_fd) {
-    connection_manager.addClient(client_fd);
+// Add a new client, starting from the throughput last seen from its address or subnet
+void Proxy::addNewClient(int client_fd, const in_addr& client_addr) {
+    connection_manager.addClient(client_fd, client_addr, throughput_priors.lookup(client_addr));
     std::cout << "New client added: " << client_fd << std::endl;
 }
 
@@ -86,6 +150,7 @@ BitrateManager& Proxy::getBitrateManager() {
     return bitrate_manager;
 }
 
+
 int Proxy::getMasterSocket(struct sockaddr_in *address) {
   int yes = 1;
   int master_socket;
@@ -105,6 +170,14 @@ int Proxy::getMasterSocket(struct sockaddr_in *address) {
     exit(EXIT_FAILURE);
   }
 
+  // every worker binds its own listening socket to the same port and the
+  // kernel spreads incoming connections across them
+  success = setsockopt(master_socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+  if (success < 0) {
+    perror("setsockopt");
+    exit(EXIT_FAILURE);
+  }
+
   // type of socket created
   address->sin_family = AF_INET;
   address->sin_addr.s_addr = INADDR_ANY;
@@ -118,438 +191,1239 @@ int Proxy::getMasterSocket(struct sockaddr_in *address) {
   }
   printf("---Listening on port %d---\n", listen_port);
 
-  // try to specify maximum of 3 pending connections for the master socket
-  if (listen(master_socket, 3) < 0) {
+  // allow a full backlog; hundreds of players may connect at once
+  if (listen(master_socket, SOMAXCONN) < 0) {
     perror("listen");
     exit(EXIT_FAILURE);
   }
   return master_socket;
 }
 
-int Proxy::openWebSock() {
-    // Create new socket to connect to the web server
-    int web_sock = socket(AF_INET, SOCK_STREAM, 0);
+// Accept every pending connection on the (non-blocking) listening socket
+void Proxy::acceptClients() {
+    while (true) {
+        struct sockaddr_in address;
+        socklen_t addrlen = sizeof(address);
+        int new_sock = accept4(master_socket, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_sock < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            return;
+        }
 
-    // Sets up the addr and port of the webserver
-    struct sockaddr_in web_addr;
-    memset(&web_addr, 0, sizeof(web_addr));
-    web_addr.sin_family = AF_INET;
-    web_addr.sin_port = htons(static_cast<uint16_t>(server_port));
-    inet_pton(AF_INET, server_ip.c_str(), &web_addr.sin_addr);
-    if (connect(web_sock, (struct sockaddr*)&web_addr, sizeof(web_addr)) < 0) {
-        // log_message("[DEBUG] Failed to open web socket.", log_path);
-        std::cout << "[DEBUG] Failed to open web socket." << std::endl;
+        // inform user of socket number - used in send and receive commands
+        printf("\n---New host connection---\n");
+        printf("socket fd is %d , ip is : %s , port : %d \n", new_sock,
+                ip_to_string(address.sin_addr).c_str(), ntohs(address.sin_port));
+
+        // add new socket to client_map in the connection_manager; with edge triggering the
+        // socket is registered once for both directions and never re-armed
+        addNewClient(new_sock, address.sin_addr);
+        event_loop.add(new_sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [this, new_sock](uint32_t events) {
+            onClientEvent(new_sock, events);
+        });
     }
-    return web_sock;
 }
 
-// Handle a client request
-void Proxy::handleClientRequest(int client_sock, std::string &request) {
-    // Parse the URI from the HTTP GET request
-    ssize_t bytes_read = -1;
-    std::string uri = get_http_uri(request);
-    size_t content_length = -1;
-
-    std::cout << "[DEBUG] Handling URI: " << uri << std::endl;
+// Close a client socket along with its web server connection
+void Proxy::closeClient(int client_sock) {
+    ClientConnection* client = connection_manager.getClient(client_sock);
+    if (client) endFlight(client->getExchange());
+    if (client && client->getExchange().log_pending) {
+        // the segment was fetched but never fully reached the client
+        HttpExchange& exchange = client->getExchange();
+        logSegmentFetch(client_sock, *client, exchange.uri, exchange.body_received, exchange.phases, exchange.bitrate);
+    }
+    if (client) prefetch_stats.bytes_wasted += client->dropPrefetched(-1, prefetch_stats.wasted);
+    for (auto& pair : prefetches) {
+        // the fd may soon belong to another client; the prefetch finishes for nobody
+        if (pair.second.client_sock != client_sock) continue;
+        pair.second.client_sock = -1;
+        pair.second.flight->prefetch_client = -1;
+    }
+    if (client && client->getWebSock() >= 0) {
+        // a response may be half read, so the connection cannot go back to the pool
+        upstream_pool.discard(client->getWebSock());
+    }
+    if (client) client->closeRelayPipe();
 
-    // Case 1: Handling manifest file requests (ends with ".mpd")
-    if (uri.find(".mpd") != std::string::npos) {
-        std::string original_manifest_uri = uri;
-        std::cout << "[DEBUG] Into manifest case." << std::endl;
+    // Somebody disconnected, get their details and print
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+    if (getpeername(client_sock, (struct sockaddr *)&address, &addrlen) == 0) {
+        printf("\n---Host disconnected---\n");
+        printf("Host disconnected , ip %s , port %d \n",
+                ip_to_string(address.sin_addr).c_str(), ntohs(address.sin_port));
+    }
 
-        // Fetch the original manifest file from the web server
-        // std::string manifest_request = construct_http_get_request(original_manifest_uri, server_ip);
-        std::string manifest_request = request;
-        ssize_t bytes_sent = send(web_sock, manifest_request.c_str(), manifest_request.size(), 0);
+    event_loop.remove(client_sock);
+    close(client_sock);
+    removeClient(client_sock);
+}
 
-        std::cout << "[DEBUG] Sent " << bytes_sent << " bytes." << std::endl;
+// Drop the web server connection of a client (closed by the server or failed)
+void Proxy::closeWebSock(ClientConnection& client) {
+    if (client.getWebSock() < 0) return;
+    upstream_pool.discard(client.getWebSock());
+    client.setWebSock(-1);
+    client.setWebSockConnecting(false);
+}
 
-        // receive the HTTP response header from the server
-        std::string header;
-        if (!read_http_header(web_sock, header)) 
-            std::cout << "[DEBUG] Failed to retrieve HTTP header for manifest." << std::endl;
-        std::cout << "[DEBUG] Header for manifest file: " << header << std::endl;
+// Hand the client's web server connection back to the pool once its response is complete
+void Proxy::releaseWebSock(ClientConnection& client) {
+    if (client.getWebSock() < 0) return;
+    if (is_connection_close(client.getExchange().response_header)) {
+        upstream_pool.discard(client.getWebSock());
+    } else {
+        upstream_pool.release(client.getWebSock());
+    }
+    client.setWebSock(-1);
+    client.setWebSockConnecting(false);
+}
 
-        // get the content length from the header
-        content_length = get_content_length(header);
+// Give the client a pooled web server connection, opening a new one if allowed.
+// Returns false if none is available right now.
+bool Proxy::attachWebSock(int client_sock, ClientConnection& client) {
+    bool connecting = false;
+    int web_sock = upstream_pool.acquireIdle(server_ip, server_port);
+    if (web_sock < 0) {
+        if (!upstream_pool.canOpen(server_ip, server_port)) return false;
+        web_sock = upstream_pool.open(server_ip, server_port);
+        if (web_sock < 0) return false;
+        connecting = true;
+    }
 
-        // create the buffer with size content_length + 1
-        // char buffer[content_length + 1];
-        std::vector<char> buffer(content_length + 1);
+    client.setWebSock(web_sock);
+    client.setWebSockConnecting(connecting);
+    client.getExchange().upstream_reused = !connecting;
+    event_loop.setHandler(web_sock, [this, client_sock, web_sock](uint32_t events) {
+        onUpstreamEvent(client_sock, web_sock, events);
+    });
+    return true;
+}
 
-        // receive content from server
-        ssize_t bytes_read = recv(web_sock, buffer.data(), content_length, MSG_WAITALL);
-        std::string manifest_content(buffer.data(), bytes_read);
-        std::cout << "[DEBUG] Manifest content: " << manifest_content << std::endl;
+// Retry the request on a fresh connection, or answer 502 once attempts run out
+bool Proxy::retryUpstream(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    closeWebSock(client);
+    if (++exchange.upstream_attempts >= MAX_UPSTREAM_ATTEMPTS) {
+        return queueResponse(client_sock, client, "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n", {});
+    }
+    return sendUpstream(client_sock, client);
+}
 
-        // Parse and store bitrates
-        std::vector<int> bitrates = parse_available_bitrates(manifest_content);
-        for (int rate : bitrates) std::cout << "[DEBUG] Bitrate = " << rate << std::endl;
-        bitrate_manager.addBitrates(original_manifest_uri, bitrates);
+// Start requests that were waiting for an upstream connection
+void Proxy::servePendingUpstream() {
+    for (size_t n = pending_upstream.size(); n > 0 && !pending_upstream.empty(); --n) {
+        int client_sock = pending_upstream.front();
+        pending_upstream.pop_front();
 
-        // Set manifest path in the ClientConnection
         ClientConnection* client = connection_manager.getClient(client_sock);
-        if (client) {
-            client->setManifestPath(original_manifest_uri);
+        if (!client || client->getWebSock() >= 0 ||
+            client->getExchange().state != ExchangeState::AwaitingUpstreamHeader) {
+            continue;
         }
+        if (!sendUpstream(client_sock, *client)) closeClient(client_sock);
+    }
+}
 
-        // Construct and fetch the "-no-list.mpd" version for the client
-        std::string no_list_manifest_uri = original_manifest_uri;
-        size_t dot_pos = no_list_manifest_uri.find_last_of('.');
-        if (dot_pos != std::string::npos) {
-            no_list_manifest_uri.insert(dot_pos, "-no-list");
+// Report the latency distribution of one phase of the segment fetches
+static void log_histogram(const char* phase, const LatencyHistogram& histogram) {
+    if (histogram.getCount() == 0) return;
+    spdlog::debug("Phase {}: count {} p50 {:.2f} ms p90 {:.2f} ms p99 {:.2f} ms max {:.2f} ms", phase,
+                  histogram.getCount(), histogram.getPercentile(0.5), histogram.getPercentile(0.9),
+                  histogram.getPercentile(0.99), histogram.getMax());
+}
+
+// Periodic housekeeping: reap idle upstream connections and report counters
+void Proxy::onTick() {
+    upstream_pool.reapIdle();
+
+    // prefetched segments their players did not ask for in time are wasted
+    if (prefetch_depth > 0) {
+        for (const auto& pair : connection_manager.getClientMap()) {
+            ClientConnection* client = connection_manager.getClient(pair.first);
+            prefetch_stats.bytes_wasted += client->dropPrefetched(PREFETCH_TTL, prefetch_stats.wasted);
         }
+    }
 
-        std::cout << "[DEBUG] No list manifest uri = " << no_list_manifest_uri << std::endl;
+    if (session_table.isEnabled()) session_table.expireIdle(SESSION_SWEEP_INTERVAL);
 
-        // std::string no_list_manifest_request = construct_http_get_request(no_list_manifest_uri, server_ip);
-        std::string no_list_manifest_request = modify_request_uri(manifest_request, no_list_manifest_uri);
-        std::cout << "[DEBUG] No list manifest request = " << no_list_manifest_request << std::endl;
-        send(web_sock, no_list_manifest_request.c_str(), no_list_manifest_request.size(), 0);
+    TimePoint now = get_current_time();
+    if (calculate_duration(last_stats_time, now) < STATS_INTERVAL) return;
+    last_stats_time = now;
 
-        // receive the HTTP response header from the server
-        std::string no_list_header;
-        if (!read_http_header(web_sock, no_list_header)) 
-            std::cout << "[DEBUG] Failed to retrieve HTTP header for manifest no list." << std::endl;
-        std::cout << "[DEBUG] No list manifest header: " << no_list_header << std::endl;
+    const UpstreamPoolStats& stats = upstream_pool.getStats();
+    spdlog::debug("Upstream pool: hits {} misses {} connects {} failures {} reaped {} avg connect {:.2f} ms max {:.2f} ms",
+                  stats.hits, stats.misses, stats.connects, stats.connect_failures, stats.reaped,
+                  stats.connects ? stats.total_connect_ms / stats.connects : 0.0, stats.max_connect_ms);
 
-        // get the content length from the header
-        content_length = get_content_length(no_list_header);
+    SegmentCacheStats cache_stats;
+    if (segment_cache.isEnabled() && segment_cache.takeStatsReport(STATS_INTERVAL, cache_stats)) {
+        uint64_t lookups = cache_stats.hits + cache_stats.misses;
+        spdlog::debug("Segment cache: hit ratio {:.1f}% ({} of {}) bytes saved {} evictions {} entries {} bytes {}",
+                      lookups ? 100.0 * cache_stats.hits / lookups : 0.0, cache_stats.hits, lookups,
+                      cache_stats.bytes_saved, cache_stats.evictions, cache_stats.entries, cache_stats.bytes_used);
+    }
 
-        // create the buffer with size content_length + 1
-        // char no_list_buffer[content_length + 1];
-        std::vector<char> no_list_buffer(content_length + 1);
+    if (abr_stats.decisions > 0) {
+        spdlog::debug("ABR ({}): decisions {} avg {:.0f} ns max {:.0f} ns", get_abr_policy_name(abr_policy), abr_stats.decisions,
+                      abr_stats.total_ns / abr_stats.decisions, abr_stats.max_ns);
+    }
 
-        // get no list manifest contest
-        bytes_read = recv(web_sock, no_list_buffer.data(), content_length, MSG_WAITALL);
-        std::string no_list_manifest_content(no_list_buffer.data(), bytes_read);
-        std::cout << "[DEBUG] No list manifest content = " << no_list_manifest_content << std::endl;
+    if (session_table.isEnabled()) spdlog::debug("Sessions: {}", session_table.size());
 
-        // concatenate the no list header and no list content
-        std::string no_list_msg = no_list_header + no_list_manifest_content;
+    log_histogram("queue", phase_histograms.queue);
+    log_histogram("ttfb", phase_histograms.ttfb);
+    log_histogram("header", phase_histograms.header);
+    log_histogram("body", phase_histograms.body);
+    log_histogram("client", phase_histograms.client);
 
-        // Send the modified manifest to the client
-        send(client_sock, no_list_msg.c_str(), no_list_msg.size(), 0);
+    if (prefetch_depth > 0) {
+        uint64_t settled = prefetch_stats.used + prefetch_stats.wasted;
+        spdlog::debug("Prefetch: accuracy {:.1f}% ({} of {}) issued {} failed {} bytes fetched {} used {} wasted {}",
+                      settled ? 100.0 * prefetch_stats.used / settled : 0.0, prefetch_stats.used, settled,
+                      prefetch_stats.issued, prefetch_stats.failed, prefetch_stats.bytes_fetched,
+                      prefetch_stats.bytes_used, prefetch_stats.bytes_wasted);
+    }
+}
 
-    // Case 2: Handling video chunk requests (ends with ".m4s")
-    } else if (uri.find(".m4s") != std::string::npos) {
-        ClientConnection* client = connection_manager.getClient(client_sock);
-        if (client) {
-            // get highest bitrate supported based on current throughput
-            int selected_bitrate = client->selectBitrate(*this);
+// Client socket is readable and/or writable
+void Proxy::onClientEvent(int client_sock, uint32_t events) {
+    ClientConnection* client = connection_manager.getClient(client_sock);
+    if (!client || client->getExchange().client_gone) return;
+
+    bool ok = true;
+    if (events & EPOLLOUT) ok = flushClient(client_sock, *client);
+    if (ok && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) ok = readClient(client_sock, *client);
+    if (ok) return;
+
+    HttpExchange& exchange = client->getExchange();
+    if (!keepFetchingForFollowers(exchange)) {
+        closeClient(client_sock);
+    } else if (exchange.relay_paused) {
+        // nothing will drain the paused relay any more
+        exchange.relay_paused = false;
+        if (!readUpstream(client_sock, *client)) closeClient(client_sock);
+    }
+}
+
+// Drain a ready client socket; starts the next exchange once a full request arrived.
+// Returns false if the connection should be closed.
+bool Proxy::readClient(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    bool closed = false;
+
+    // edge-triggered: keep reading until the socket reports EAGAIN
+    while (true) {
+        // pipelined requests queue up in request_buffer behind the current exchange;
+        // past the limit the rest stays in the socket until the exchange finishes
+        if (exchange.state != ExchangeState::ReadingRequest && exchange.request_buffer.size() >= MAX_PIPELINED_BYTES) {
+            exchange.client_read_paused = true;
+            break;
+        }
+
+        ssize_t valread = exchange.request_buffer.readOnce(client_sock);
+        if (valread > 0) {
+            continue;
+        } else if (valread == 0) {
+            // a half-closed client still gets answers to the requests it sent
+            exchange.client_eof = true;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) closed = true;
+            break;
+        }
+    }
+
+    if (closed) return false;
+
+    // requests that arrive while an exchange is in flight wait in request_buffer
+    if (exchange.state == ExchangeState::ReadingRequest) return startRequest(client_sock, client);
+    return true;
+}
 
-            // modify URI to contain correct bitrate
-            std::string modified_uri = modify_uri_bitrate(uri, selected_bitrate);
-            
-            // edit request to contain updated URI
-            std::string modified_request = modify_request_uri(request, modified_uri);
+// Parse the request at the front of the client's buffer. Once it is complete (header
+// and body), decide how to handle it and forward it to the web server. Requests are
+// handled one at a time, so responses go back in the order the requests came in.
+bool Proxy::startRequest(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    ParseResult result = exchange.request_parser.parse(exchange.request_buffer.view());
+    if (result == ParseResult::Invalid) {
+        std::cout << "[DEBUG] Malformed request from client " << client_sock << std::endl;
+        return false;
+    }
 
-            std::cout << "[DEBUG] Modified Request: " << modified_request << std::endl;
+    // views into request_buffer, valid until the request is consumed below
+    const HttpRequest& request = exchange.request_parser.request();
+    if (result == ParseResult::Complete && request.content_length > MAX_REQUEST_BODY_SIZE) {
+        std::cout << "[DEBUG] Request body too large from client " << client_sock << std::endl;
+        return false;
+    }
+    size_t request_length = request.header_length + request.content_length;
+    if (result == ParseResult::Incomplete || exchange.request_buffer.size() < request_length) {
+        // nothing more will arrive from a client that already closed its end
+        return !exchange.client_eof;
+    }
+    exchange.phases.request_read = get_current_time();
+    std::string_view raw_request = exchange.request_buffer.view().substr(0, request.header_length);
+    std::cout << "Received request: " << raw_request << std::endl;
 
-            // forward the request to the client
-            send(web_sock, modified_request.c_str(), modified_request.size(), 0);
+    // Parse the URI from the HTTP GET request
+    exchange.uri = get_http_uri(request);
+    SegmentCache::Entry cached;
+    std::shared_ptr<SegmentFlight> follow;
+    BitrateManager::Manifest manifest;
+    bool manifest_expired = true;
+    std::cout << "[DEBUG] Handling URI: " << exchange.uri << std::endl;
 
-            TimePoint start_time = get_current_time();
+    // Case 1: Handling manifest file requests (ends with ".mpd")
+    if (exchange.uri.find(".mpd") != std::string::npos) {
+        std::cout << "[DEBUG] Into manifest case." << std::endl;
+        exchange.kind = RequestKind::Manifest;
 
-            // receive the HTTP response header from the server
-            std::string header;
-            if (!read_http_header(web_sock, header)) 
-                std::cout << "[DEBUG] Failed to retrieve HTTP header for video." << std::endl;
+        // within its TTL the manifest is answered from memory; after that the copy in hand
+        // is revalidated with the web server rather than fetched again
+        manifest = bitrate_manager.getManifest(exchange.uri, manifest_ttl, manifest_expired);
+        if (manifest && manifest_expired) exchange.stale_manifest = manifest;
 
-            // get the content length from the header
-            content_length = get_content_length(header);
+    // Case 2: Handling video chunk requests (ends with ".m4s")
+    } else if (exchange.uri.find(".m4s") != std::string::npos) {
+        // get highest bitrate supported based on current throughput
+        exchange.kind = RequestKind::Segment;
+        joinSession(client, exchange.uri);
+        TimePoint decision_start = get_current_time();
+        exchange.bitrate = client.selectBitrate(bitrate_manager, abr_policy, decision_start);
+        double decision_ns = calculate_duration(decision_start, get_current_time()) * 1e9;
+        ++abr_stats.decisions;
+        abr_stats.total_ns += decision_ns;
+        abr_stats.max_ns = std::max(abr_stats.max_ns, decision_ns);
+
+        // modify URI to contain correct bitrate
+        exchange.uri = modify_uri_bitrate(exchange.uri, exchange.bitrate);
+
+        // a segment prefetched for this client goes out without asking anyone
+        cached = client.takePrefetched(exchange.uri);
+        if (cached) {
+            ++prefetch_stats.used;
+            prefetch_stats.bytes_used += cached->size();
+        } else if (segment_cache.isEnabled()) {
+            cached = segment_cache.lookup(exchange.uri);
+        }
 
-            // create the buffer with size content_length + 1
-            // char buffer[content_length + 1];
-            std::vector<char> buffer(content_length);
+        // the same segment may already be on its way for another client, or prefetched for this one
+        if (!cached) {
+            auto it = in_flight.find(exchange.uri);
+            if (it != in_flight.end()) follow = it->second;
+            if (follow && follow->prefetch_client == client_sock) follow->prefetch_claimed = true;
+        }
 
-            // receive content from server
-            bytes_read = recv(web_sock, buffer.data(), content_length, MSG_WAITALL);
-            TimePoint end_time = get_current_time();
+    // Case 3: The player reports a segment it finished receiving. The web server has nothing
+    // to say about it (it answers 418), so the proxy takes the report and answers it itself.
+    } else if (request.method == "POST" && exchange.uri.rfind("/on-fragment-received", 0) == 0) {
+        exchange.kind = RequestKind::Beacon;
+        recordBeacon(client, request);
+        cached = BEACON_RESPONSE;
 
-            if (bytes_read <= 0) {
-                std::cerr << "[DEBUG] Error receiving video chunk data: " << strerror(errno) << std::endl;
-                return;
+    // Case 4: Handling requests for HTML, JavaScript, CSS, and other files
+    } else {
+        exchange.kind = RequestKind::PassThrough;
+    }
+
+    bool from_memory = cached || (manifest && !manifest_expired);
+    if (!from_memory) {
+        // every request goes upstream in one rewrite: the (possibly new) URI, the web server
+        // as Host, and keep-alive so the connection can return to the pool
+        HttpHeaderField upstream_fields[4] = {{"Host", server_ip}, {"Connection", "keep-alive"}};
+        size_t field_count = 2;
+        std::span<const std::string_view> drop;
+        if (exchange.kind == RequestKind::Manifest) {
+            // the player's own validators refer to the "-no-list" form it was given, not to the
+            // full manifest the proxy needs; only the proxy's copy is revalidated
+            static constexpr std::string_view player_validators[] = {"If-None-Match", "If-Modified-Since"};
+            drop = player_validators;
+            if (exchange.stale_manifest && !exchange.stale_manifest->etag.empty()) {
+                upstream_fields[field_count++] = {"If-None-Match", exchange.stale_manifest->etag};
+            }
+            if (exchange.stale_manifest && !exchange.stale_manifest->last_modified.empty()) {
+                upstream_fields[field_count++] = {"If-Modified-Since", exchange.stale_manifest->last_modified};
             }
+        }
+        rewrite_request(request, {.uri = exchange.uri, .set = std::span(upstream_fields, field_count), .drop = drop}, exchange.upstream_request);
+        std::cout << "[DEBUG] Modified Request: " << exchange.upstream_request << std::endl;
 
-            std::cout << "[DEBUG] Received " << bytes_read << " bytes of video data from server." << std::endl;
+        // the body (e.g. a beacon's) is forwarded unchanged
+        exchange.upstream_request.append(exchange.request_buffer.data() + request.header_length,
+                                         request.content_length);
+    }
+    exchange.close_after = !request.keep_alive;
+
+    // bytes past this request stay buffered for the next one
+    exchange.request_buffer.consume(request_length);
+    exchange.request_parser.reset();
+    if (exchange.kind == RequestKind::Segment && prefetch_depth > 0) schedulePrefetch(client_sock, client);
+    if (cached) return serveCached(client_sock, client, std::move(cached));
+    if (manifest && !manifest_expired) return serveManifest(client_sock, client, manifest);
+    if (follow) return followFlight(client_sock, client, std::move(follow));
+
+    // later requests for this segment attach to this fetch instead of going upstream
+    if (exchange.kind == RequestKind::Segment) {
+        exchange.flight = std::make_shared<SegmentFlight>();
+        exchange.flight_leader = true;
+        in_flight[exchange.uri] = exchange.flight;
+    }
+    return sendUpstream(client_sock, client);
+}
 
-            // log throughput and other metrics
-            double duration = calculate_duration(start_time, end_time);
-            double new_throughput = calculate_throughput(bytes_read, duration);
-            connection_manager.updateClientThroughput(client_sock, new_throughput, alpha);
+// Start writing exchange.upstream_request on a pooled web server connection. If the
+// pool has none to give, the client waits in pending_upstream until one frees up.
+bool Proxy::sendUpstream(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    exchange.upstream_sent = 0;
+    exchange.upstream_in.clear();
+    exchange.response_header.clear();
+    exchange.body.clear();
+    exchange.content_length = 0;
+    exchange.state = ExchangeState::AwaitingUpstreamHeader;
+
+    if (client.getWebSock() < 0 && !attachWebSock(client_sock, client)) {
+        pending_upstream.push_back(client_sock);
+        return true;
+    }
+    return flushUpstream(client);
+}
 
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            getpeername(client_sock, (struct sockaddr*)&client_addr, &client_len);
-            std::string browser_ip = inet_ntoa(client_addr.sin_addr);
-            std::string chunkname = extract_chunk_name(modified_uri);
-            logger.log_chunk_transfer(browser_ip, chunkname, server_ip, duration, new_throughput, client->getCurrentThroughput(), selected_bitrate);
+// Write as much of the pending upstream request as the web socket accepts
+bool Proxy::flushUpstream(ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    if (client.isWebSockConnecting() || exchange.state != ExchangeState::AwaitingUpstreamHeader) return true;
+
+    while (exchange.upstream_sent < exchange.upstream_request.size()) {
+        ssize_t sent = send(client.getWebSock(), exchange.upstream_request.data() + exchange.upstream_sent,
+                            exchange.upstream_request.size() - exchange.upstream_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            std::cout << "[DEBUG] Failed to pass request to web socket " << client.getWebSock() << std::endl;
+            return false;
+        }
+        exchange.upstream_sent += sent;
+        if (exchange.upstream_sent == exchange.upstream_request.size()) {
+            exchange.phases.upstream_sent = get_current_time();
+        }
+    }
+    return true;
+}
 
-            // store content in a string
-            // std::string videoChunk(buffer.data(), bytes_read);
+// Web server socket is readable and/or writable
+void Proxy::onUpstreamEvent(int client_sock, int web_sock, uint32_t events) {
+    ClientConnection* client = connection_manager.getClient(client_sock);
+    if (!client || client->getWebSock() != web_sock) return;
+
+    bool ok = true;
+    if ((events & EPOLLOUT) && client->isWebSockConnecting()) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(web_sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        upstream_pool.connectFinished(web_sock, err == 0);
+        if (err != 0) {
+            // the pool already closed the socket and is backing off
+            std::cout << "[DEBUG] Failed to open web socket: " << strerror(err) << std::endl;
+            client->setWebSock(-1);
+            client->setWebSockConnecting(false);
+            if (!retryUpstream(client_sock, *client)) closeClient(client_sock);
+            return;
+        }
+        client->setWebSockConnecting(false);
+    }
+    if (events & EPOLLOUT) {
+        ok = flushUpstream(*client);
+        // a pooled connection the server already closed: resend on a fresh one
+        if (!ok && client->getExchange().upstream_reused) ok = retryUpstream(client_sock, *client);
+    }
+    if (ok && client->getWebSock() == web_sock && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        ok = readUpstream(client_sock, *client);
+    }
+    if (!ok) closeClient(client_sock);
+}
 
-            // concatenate header and content
-            // std::string msg = header + videoChunk;
+// Drain the web socket into the current exchange. Reading pauses while a relayed body
+// is backed up behind a slow client. Returns false if the client must be closed.
+bool Proxy::readUpstream(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    int web_sock = client.getWebSock();
+    bool closed = false;
 
-            // first, send the header
-            ssize_t header_sent = send(client_sock, header.c_str(), header.size(), 0);
-            if (header_sent == -1) {
-                std::cerr << "[DEBUG] Error sending HTTP header to client: " << strerror(errno) << std::endl;
-                return;
+    while (true) {
+        size_t want = read_buffer.size();
+        if (exchange.state == ExchangeState::RelayingBody) {
+            // backpressure: leave the rest in the socket until the client catches up
+            if (exchange.relay && exchange.pendingBytes() >= RELAY_HIGH_WATER) {
+                exchange.relay_paused = true;
+                return true;
             }
+            // never read past this response's body
+            want = std::min(want, exchange.content_length - exchange.body_received);
+        }
 
-            // now, send the video chunk (binary data)
-            ssize_t chunk_sent = send(client_sock, buffer.data(), bytes_read, 0);
-            if (chunk_sent == -1) {
-                std::cerr << "[DEBUG] Error sending video chunk to client: " << strerror(errno) << std::endl;
-                return;
+        bool reading_header = exchange.state == ExchangeState::AwaitingUpstreamHeader;
+        ssize_t bytes_read;
+        if (reading_header) {
+            bytes_read = exchange.upstream_in.readOnce(web_sock);
+        } else if (exchange.splicing) {
+            bytes_read = spliceFromUpstream(client_sock, client, want);
+            if (bytes_read == SPLICE_PIPE_FULL) {
+                exchange.relay_paused = true;
+                return true;
             }
+            if (bytes_read == SPLICE_UNSUPPORTED) continue;  // fall back to recv
+        } else {
+            bytes_read = recv(web_sock, read_buffer.data(), want, 0);
+        }
 
-            std::cout << "[DEBUG] Sent " << chunk_sent << " bytes of video chunk to client " << client_sock << std::endl;
+        if (bytes_read > 0) {
+            if (reading_header && exchange.phases.first_byte == TimePoint{}) exchange.phases.first_byte = get_current_time();
+            bool ok = reading_header       ? onUpstreamHeader(client_sock, client)
+                      : exchange.splicing ? onSplicedData(client_sock, client, bytes_read)
+                                          : onUpstreamData(client_sock, client, read_buffer.data(), bytes_read);
+            if (!ok) return false;
+            // the exchange finished and handed the web socket back to the pool
+            if (client.getWebSock() != web_sock) return true;
+        } else if (bytes_read == 0) {
+            closed = true;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) closed = true;
+            break;
+        }
+    }
+
+    if (closed) {
+        std::cout << "[DEBUG] Connection closed by the server." << std::endl;
+
+        // a keep-alive connection the server closed before answering is retried once;
+        // a response cut short cannot be recovered
+        if (exchange.state == ExchangeState::AwaitingUpstreamHeader && exchange.upstream_in.empty() &&
+            exchange.upstream_reused) {
+            return retryUpstream(client_sock, client);
+        }
+        closeWebSock(client);
+        if (exchange.state == ExchangeState::AwaitingUpstreamHeader || exchange.state == ExchangeState::RelayingBody) {
+            return false;
+        }
+    }
+    return true;
+}
 
-            // send the http packet with the video chunk to the client
-            // ssize_t bytes_sent = send(client_sock, msg.c_str(), msg.size(), 0);
-            
-            // error checking for send
-            // if (bytes_sent == -1) {
-            //     std::cerr << "[DEBUG] Error in sending video chunks to client: " << strerror(errno) << std::endl;
-            // } else {
-            //     std::cout << "[DEBUG] " << bytes_sent << " bytes of video sent to client " << client_sock << std::endl;
-            // }
+// Check whether the response header from the web server is complete. Once it is, set
+// up the body transfer and feed it the body bytes that arrived along with the header.
+bool Proxy::onUpstreamHeader(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    size_t header_len = exchange.upstream_in.findHeaderEnd();
+    if (header_len == 0) return true;
+
+    exchange.response_header = exchange.upstream_in.take(header_len);
+    exchange.phases.header_done = get_current_time();
+    exchange.content_length = get_content_length(exchange.response_header);
+    exchange.body_received = 0;
+    exchange.state = ExchangeState::RelayingBody;
+    std::cout << "[DEBUG] Header of response from server: " << exchange.response_header << std::endl;
+    if (exchange.kind == RequestKind::Segment) exchange.tcp_mark = mark_tcp_rate(client.getWebSock());
+
+    // everything but the full manifest (which the proxy parses itself) is streamed through;
+    // segment bodies are never inspected, so they can bypass user space entirely
+    exchange.relay = exchange.kind != RequestKind::Manifest;
+    exchange.splicing = exchange.kind == RequestKind::Segment && splice_enabled;
+
+    // a segment that other clients are waiting for, or that will be cached, is also kept
+    // in user space while it is relayed, which rules out splice
+    if (exchange.flight_leader) {
+        size_t total = exchange.response_header.size() + exchange.content_length;
+        bool cacheable = segment_cache.isEnabled() && get_status_code(exchange.response_header) == 200 &&
+                         total <= segment_cache.getMaxEntrySize();
+        bool shared = !exchange.flight->followers.empty() && total <= MAX_COALESCED_SIZE;
+        if (cacheable || shared) {
+            exchange.splicing = false;
+            exchange.flight->data.reserve(total);
+            exchange.flight->data = exchange.response_header;
+            exchange.flight->total = total;
+            notifyFollowers(exchange.flight);
+        } else {
+            endFlight(exchange);
         }
+    }
+    if (exchange.relay) {
+        exchange.response = exchange.response_header;
+        exchange.response_sent = 0;
+    } else {
+        exchange.body.reserve(exchange.content_length);
+    }
+
+    // anything past the header is the start of the body; it is at most one read slice,
+    // so it fits the scratch buffer and the exchange is free to reset while handling it
+    size_t len = exchange.upstream_in.size();
+    exchange.phases.header_body_bytes = std::min(len, exchange.content_length);
+    memcpy(read_buffer.data(), exchange.upstream_in.data(), len);
+    exchange.upstream_in.clear();
+    return onUpstreamData(client_sock, client, read_buffer.data(), len);
+}
 
-    // Case 3: Handling requests for HTML, JavaScript, CSS, and other files
+// Feed body bytes read from the web server into the exchange; the body is either
+// relayed to the client or buffered (full manifests)
+bool Proxy::onUpstreamData(int client_sock, ClientConnection& client, const char* data, size_t len) {
+    HttpExchange& exchange = client.getExchange();
+
+    if (exchange.state != ExchangeState::RelayingBody) {
+        std::cout << "[DEBUG] Discarding " << len << " unexpected bytes from web socket " << client.getWebSock() << std::endl;
+        return true;
+    }
+
+    size_t take = std::min(len, exchange.content_length - exchange.body_received);
+    exchange.body_received += take;
+    if (exchange.relay) {
+        if (!relayToClient(client_sock, client, data, take) && !keepFetchingForFollowers(exchange)) return false;
+        if (exchange.flight_leader) {
+            exchange.flight->data.append(data, take);
+            notifyFollowers(exchange.flight);
+        }
     } else {
-        // Simply forward the request to the web server
-        //std::string pass_through_request = construct_http_get_request(uri, server_ip);
-        std::string pass_through_request = updateHostHeader(request, server_ip);
-        std::cout << "[DEBUG] request = " << pass_through_request << std::endl;
+        exchange.body.insert(exchange.body.end(), data, data + take);
+    }
+
+    if (exchange.body_received == exchange.content_length) {
+        return finishUpstreamResponse(client_sock, client);
+    }
+    return true;
+}
+
+// Move up to len body bytes from the web socket into the client's relay pipe. Returns the
+// byte count like recv(), SPLICE_PIPE_FULL when the pipe must drain first, or
+// SPLICE_UNSUPPORTED after switching the exchange back to the buffered path.
+ssize_t Proxy::spliceFromUpstream(int client_sock, ClientConnection& client, size_t len) {
+    HttpExchange& exchange = client.getExchange();
+#ifdef __linux__
+    const int* relay_pipe = client.getRelayPipe();
+    if (relay_pipe != nullptr && client.getRelayPipeSize() > 0) {
+        // bytes ahead of this slice (header, first body bytes) must reach the client first
+        if (!writeClient(client_sock, client)) return -1;
+
+        size_t room = client.getRelayPipeSize() - exchange.pipe_bytes;
+        if (room == 0) return SPLICE_PIPE_FULL;
+
+        ssize_t moved = splice(client.getWebSock(), nullptr, relay_pipe[1], nullptr, std::min(len, room),
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved >= 0 || errno == EINTR) return moved;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // EAGAIN means either the socket is drained or the pipe ran out of slots
+            int available = 0;
+            if (ioctl(client.getWebSock(), FIONREAD, &available) == 0 && available > 0) return SPLICE_PIPE_FULL;
+            return -1;
+        }
+        if (errno != EINVAL && errno != ENOSYS) return -1;
+        if (exchange.pipe_bytes > 0) return -1;
+    }
+#endif
+    // no splice on this system (or no pipe): use the buffered relay from now on
+    spdlog::debug("splice unavailable, falling back to buffered relay");
+    (void)len;
+    splice_enabled = false;
+    exchange.splicing = false;
+    return SPLICE_UNSUPPORTED;
+}
+
+// Account for body bytes spliced into the relay pipe and push them on to the client
+bool Proxy::onSplicedData(int client_sock, ClientConnection& client, size_t len) {
+    HttpExchange& exchange = client.getExchange();
+    exchange.body_received += len;
+    exchange.pipe_bytes += len;
+    if (!writeClient(client_sock, client)) return false;
+
+    if (exchange.body_received == exchange.content_length) {
+        return finishUpstreamResponse(client_sock, client);
+    }
+    return true;
+}
+
+// Forward a slice of a relayed body; whatever the client socket does not take right
+// away is queued behind the already pending bytes
+bool Proxy::relayToClient(int client_sock, ClientConnection& client, const char* data, size_t len) {
+    HttpExchange& exchange = client.getExchange();
+    if (exchange.client_gone) return true;
+    if (exchange.response_sent == exchange.response.size()) {
+        exchange.response.clear();
+        exchange.response_sent = 0;
+
+        // nothing pending: try to send straight from the read buffer without copying
+        while (len > 0) {
+            ssize_t sent = send(client_sock, data, len, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                std::cerr << "[DEBUG] Error in sending data to client: " << strerror(errno) << std::endl;
+                return false;
+            }
+            data += sent;
+            len -= sent;
+        }
+    }
+    exchange.response.append(data, len);
+    return writeClient(client_sock, client);
+}
+
+// The full response for the current exchange has arrived from the web server
+bool Proxy::finishUpstreamResponse(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+
+    switch (exchange.kind) {
+    case RequestKind::Manifest: {
+        int status = get_status_code(exchange.response_header);
 
-        // forward client request to web server
-        if (send(web_sock, pass_through_request.c_str(), pass_through_request.size(), 0) <= 0) {
-            std::cout << "[DEBUG] Failed to pass request to web socket " << web_sock << std::endl;
+        // the copy in memory is still current: keep its ladder and serve it for another TTL
+        if (status == 304 && exchange.stale_manifest) {
+            std::cout << "[DEBUG] Manifest " << exchange.uri << " unchanged on the web server" << std::endl;
+            bitrate_manager.revalidateManifest(exchange.uri);
+            releaseWebSock(client);
+            return serveManifest(client_sock, client, exchange.stale_manifest);
         }
-        std::cout << "[DEBUG] Passed request to web socket " << web_sock << std::endl;
 
-        // receive the HTTP response header from the server
-        std::string header;
-        if (!read_http_header(web_sock, header)) 
-            std::cout << "[DEBUG] Failed to retrieve HTTP header for other file." << std::endl;
-        std::cout << "[DEBUG] Header of response from server: " << header << std::endl;
+        // errors go back to the player as they are
+        if (status != 200) break;
+        std::string manifest_content(exchange.body.begin(), exchange.body.end());
+
+        // Parse the bitrates
+        std::vector<int> bitrates = parse_available_bitrates(manifest_content);
+        for (int rate : bitrates) std::cout << "[DEBUG] Bitrate = " << rate << std::endl;
+
+        // Build the "-no-list" version for the client from the manifest already in hand
+        // rather than fetching it from the web server
+        std::string no_list_manifest = make_no_list_manifest(manifest_content);
+        std::string client_response = set_content_length(exchange.response_header, no_list_manifest.size());
+        client_response += no_list_manifest;
+
+        // Store the ladder and both forms, with the validators for the next revalidation
+        double segment_duration = parse_segment_duration(manifest_content);
+        BitrateManager::ManifestForms forms{std::move(manifest_content), std::move(client_response),
+                                            get_header_value(exchange.response_header, "ETag"),
+                                            get_header_value(exchange.response_header, "Last-Modified"),
+                                            segment_duration};
+        BitrateManager::Manifest manifest = bitrate_manager.addManifest(exchange.uri, bitrates, std::move(forms));
+
+        releaseWebSock(client);
+        return serveManifest(client_sock, client, manifest);
+    }
+
+    case RequestKind::Segment: {
+        // the last body byte has arrived; the chunk is logged once the client has it too
+        std::cout << "[DEBUG] Received " << exchange.body_received << " bytes of video data from server." << std::endl;
+        exchange.phases.body_done = get_current_time();
+        recordSegmentFetch(client, exchange.uri, exchange.body_received, exchange.phases,
+                           sample_tcp_rate(client.getWebSock(), exchange.tcp_mark));
+        exchange.log_pending = true;
+
+        if (exchange.flight_leader) {
+            if (get_status_code(exchange.response_header) == 200) segment_cache.insert(exchange.uri, exchange.flight->data);
+            endFlight(exchange);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    // the web server connection is free for other clients while this response is written
+    releaseWebSock(client);
+    if (exchange.relay) {
+        exchange.state = ExchangeState::WritingResponse;
+        return flushClient(client_sock, client);
+    }
+    return queueResponse(client_sock, client, exchange.response_header, exchange.body);
+}
+
+// Update the client's throughput estimate from a segment fetched for it. Only the body
+// phase is timed; waiting for the web server and writing to the client are left out.
+void Proxy::recordSegmentFetch(ClientConnection& client, const std::string& uri, size_t bytes,
+                               const RequestPhases& phases, const TcpRateSample& tcp) {
+    double duration;
+    double new_throughput = phases.bodyThroughput(bytes, duration);
+
+    // the wall-clock rate includes the server's think time and this worker's scheduling
+    // delays; the kernel's count of the bytes received does not
+    double sample = new_throughput;
+    if (tcp.throughput > 0) sample = tcp_info_weight * tcp.throughput + (1 - tcp_info_weight) * new_throughput;
+    client.updateThroughput(sample, alpha);
+    throughput_priors.update(client.getClientAddress(), client.getCurrentThroughput(), alpha);
+    spdlog::debug("Throughput of {}: wall clock {:.2f} Kbps, TCP_INFO {:.2f} Kbps (rtt {:.2f} ms, min rtt {:.2f} ms), "
+                  "sample {:.2f} Kbps, EWMA {:.2f} Kbps",
+                  uri, new_throughput, tcp.throughput, tcp.rtt, tcp.min_rtt, sample, client.getCurrentThroughput());
+}
+
+// Log a segment fetched for a client, with how long each phase took
+void Proxy::logSegmentFetch(int client_sock, ClientConnection& client, const std::string& uri, size_t bytes,
+                            const RequestPhases& phases, int bitrate) {
+    double duration;
+    double new_throughput = phases.bodyThroughput(bytes, duration);
+    ChunkPhases durations = phases.durations();
+    phase_histograms.record(durations);
+
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    getpeername(client_sock, (struct sockaddr*)&client_addr, &client_len);
+    std::string browser_ip = ip_to_string(client_addr.sin_addr);
+    std::string chunkname = extract_chunk_name(uri);
+    logger.log_chunk_transfer(browser_ip, chunkname, server_ip, duration, new_throughput,
+                              client.getCurrentThroughput(), bitrate, log_phases ? &durations : nullptr);
+}
+
+// Answer a request from memory: a segment from the cache or the client's prefetched
+// segments, or the reply to a beacon. The web server is not involved, so the transfer is
+// kept out of the throughput estimate.
+bool Proxy::serveCached(int client_sock, ClientConnection& client, SegmentCache::Entry cached) {
+    HttpExchange& exchange = client.getExchange();
+    std::cout << "[DEBUG] Serving " << exchange.uri << " from memory" << std::endl;
+    exchange.cached_response = std::move(cached);
+    exchange.cached_sent = 0;
+    exchange.state = ExchangeState::WritingResponse;
+    return flushClient(client_sock, client);
+}
+
+// Parse a header holding a non-negative integer
+static bool parse_header_number(std::string_view value, uint64_t& number) {
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+    return error == std::errc() && end == value.data() + value.size() && !value.empty();
+}
+
+// Take a player's report of a segment it received: the segment is now in its buffer, and
+// the segment's size and the player's timestamps (ms) give the throughput the player saw
+void Proxy::recordBeacon(ClientConnection& client, const HttpRequest& request) {
+    joinSession(client, "");
+    client.addBufferedSegment(true, get_current_time());
+
+    uint64_t size, start, end;
+    if (parse_header_number(request.header("X-Fragment-Size"), size) &&
+        parse_header_number(request.header("X-Timestamp-Start"), start) &&
+        parse_header_number(request.header("X-Timestamp-End"), end) && end > start) {
+        client.recordFragment(size, (end - start) / 1000.0, alpha);
+        spdlog::debug("Beacon: {} bytes in {} ms, player throughput {:.2f} Kbps", size, end - start,
+                      client.getPlayerThroughput());
+    }
+}
+
+// A connection that has not asked for a manifest yet continues its player's session: the
+// one at the same address whose manifest the segment uri belongs to (any, for beacons)
+void Proxy::joinSession(ClientConnection& client, const std::string& uri) {
+    if (!session_table.isEnabled() || client.hasManifest()) return;
+    SessionTable::Session session = session_table.find(client.getClientAddress(), uri);
+    if (session) client.setSession(std::move(session));
+}
+
+// Answer a manifest request with the "-no-list" response kept by the bitrate manager,
+// written straight out of the shared copy
+bool Proxy::serveManifest(int client_sock, ClientConnection& client, const BitrateManager::Manifest& manifest) {
+    HttpExchange& exchange = client.getExchange();
+    if (session_table.isEnabled()) {
+        // join the player's session, which may have been going on other connections
+        client.setSession(session_table.attach(client.getClientAddress(), exchange.uri, client.getSession()));
+    } else {
+        client.setManifestPath(exchange.uri);
+    }
+    client.setLadder(manifest->ladder);
+    client.setSegmentDuration(manifest->segment_duration);
+    exchange.cached_response = std::shared_ptr<const std::string>(manifest, &manifest->client_response);
+    exchange.cached_sent = 0;
+    exchange.state = ExchangeState::WritingResponse;
+    return flushClient(client_sock, client);
+}
+
+// Attach to another client's fetch of the same segment and relay its bytes as they come in.
+// Like a cache hit, this transfer is not a measurement of the network.
+bool Proxy::followFlight(int client_sock, ClientConnection& client, std::shared_ptr<SegmentFlight> flight) {
+    HttpExchange& exchange = client.getExchange();
+    std::cout << "[DEBUG] Joining the fetch of " << exchange.uri << " already in flight" << std::endl;
+    flight->followers.push_back(client_sock);
+    exchange.flight = std::move(flight);
+    exchange.flight_leader = false;
+    exchange.flight_sent = 0;
+    exchange.state = ExchangeState::FollowingFetch;
+    return flushClient(client_sock, client);
+}
+
+// Push newly arrived flight bytes (or its failure) to the clients following it
+void Proxy::notifyFollowers(const std::shared_ptr<SegmentFlight>& flight) {
+    // flushing may finish, restart or close followers, so walk a copy
+    std::vector<int> followers = flight->followers;
+    for (int follower_sock : followers) {
+        ClientConnection* follower = connection_manager.getClient(follower_sock);
+        if (!follower || follower->getExchange().flight != flight) continue;
+        if (!flushClient(follower_sock, *follower)) closeClient(follower_sock);
+    }
+}
+
+// The client leading a segment flight failed. If others follow the flight, keep fetching
+// for them and close the client once the segment is complete; returns false otherwise.
+bool Proxy::keepFetchingForFollowers(HttpExchange& exchange) {
+    if (!exchange.flight_leader || exchange.flight->followers.empty()) return false;
+    if (exchange.state != ExchangeState::AwaitingUpstreamHeader && exchange.state != ExchangeState::RelayingBody) {
+        return false;
+    }
+    std::cout << "[DEBUG] Client left; finishing the fetch of " << exchange.uri << " for its followers" << std::endl;
+    exchange.client_gone = true;
+    exchange.response.clear();
+    exchange.response_sent = 0;
+    return true;
+}
+
+// Stop leading the exchange's segment flight. Later requests for the segment start a
+// new fetch; followers of a flight that did not complete fetch for themselves.
+void Proxy::endFlight(HttpExchange& exchange) {
+    if (!exchange.flight_leader) return;
+    std::shared_ptr<SegmentFlight> flight = std::move(exchange.flight);
+    exchange.flight_leader = false;
+
+    auto it = in_flight.find(exchange.uri);
+    if (it != in_flight.end() && it->second == flight) in_flight.erase(it);
+    if (flight->total == 0 || flight->data.size() < flight->total) flight->failed = true;
+    notifyFollowers(flight);
+}
+
+// Fetch the segments after the one just requested, at the bitrate just picked for it, so
+// they are in hand when the player asks. Prefetching is opportunistic: it never waits for
+// an upstream connection and holds back while player requests are queued for one.
+void Proxy::schedulePrefetch(int client_sock, ClientConnection& client) {
+    const HttpExchange& exchange = client.getExchange();
+    int segment = get_segment_number(exchange.uri);
+    if (segment < 0) return;
+
+    for (size_t ahead = 1; ahead <= prefetch_depth && pending_upstream.empty(); ++ahead) {
+        std::string uri = modify_uri_segment(exchange.uri, segment + static_cast<int>(ahead));
+        if (client.hasPrefetched(uri) || in_flight.count(uri) > 0) continue;
+        if (segment_cache.isEnabled() && segment_cache.contains(uri)) continue;
+        startPrefetch(client_sock, uri, exchange.bitrate);
+    }
+}
+
+// Request uri for client_sock on a web server connection of the prefetch's own
+void Proxy::startPrefetch(int client_sock, const std::string& uri, int bitrate) {
+    bool connecting = false;
+    int web_sock = upstream_pool.acquireIdle(server_ip, server_port);
+    if (web_sock < 0) {
+        if (!upstream_pool.canOpen(server_ip, server_port)) return;
+        web_sock = upstream_pool.open(server_ip, server_port);
+        if (web_sock < 0) return;
+        connecting = true;
+    }
+
+    PrefetchFetch& fetch = prefetches[web_sock];
+    fetch.client_sock = client_sock;
+    fetch.uri = uri;
+    fetch.bitrate = bitrate;
+    fetch.request = "GET " + uri + " HTTP/1.1\r\nHost: " + server_ip + "\r\nConnection: keep-alive\r\n\r\n";
+    fetch.connecting = connecting;
+    fetch.flight = std::make_shared<SegmentFlight>();
+    fetch.flight->prefetch_client = client_sock;
+
+    // the player asking before the segment arrived joins the fetch like any other client
+    in_flight[uri] = fetch.flight;
+    ++prefetch_stats.issued;
+    std::cout << "[DEBUG] Prefetching " << uri << " for client " << client_sock << std::endl;
+
+    event_loop.setHandler(web_sock, [this, web_sock](uint32_t events) { onPrefetchEvent(web_sock, events); });
+    // a pooled connection is already writable and will not signal it again
+    if (!connecting && !flushPrefetch(web_sock, fetch)) endPrefetch(web_sock, false);
+}
+
+// Web server socket of a prefetch is readable and/or writable
+void Proxy::onPrefetchEvent(int web_sock, uint32_t events) {
+    auto it = prefetches.find(web_sock);
+    if (it == prefetches.end()) return;
+    PrefetchFetch& fetch = it->second;
+
+    if ((events & EPOLLOUT) && fetch.connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(web_sock, SOL_SOCKET, SO_ERROR, &err, &len);
+        upstream_pool.connectFinished(web_sock, err == 0);
+        if (err != 0) {
+            // the pool already closed the socket and is backing off
+            endPrefetch(web_sock, false);
+            return;
+        }
+        fetch.connecting = false;
+    }
 
-        // get the content length from the header
-        content_length = get_content_length(header);
-        std::cout << "[DEBUG] Content length = " << content_length << std::endl;
+    bool ok = true;
+    if (events & EPOLLOUT) ok = flushPrefetch(web_sock, fetch);
+    if (ok && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) ok = readPrefetch(web_sock, fetch);
+    if (!ok) endPrefetch(web_sock, false);
+}
 
-        // create the buffer with size content_length + 1
-        // char buffer[content_length + 1];
-        std::vector<char> buffer(content_length + 1);
+// Write as much of the prefetch request as the web socket accepts
+bool Proxy::flushPrefetch(int web_sock, PrefetchFetch& fetch) {
+    while (fetch.request_sent < fetch.request.size()) {
+        ssize_t sent = send(web_sock, fetch.request.data() + fetch.request_sent,
+                            fetch.request.size() - fetch.request_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        fetch.request_sent += sent;
+        if (fetch.request_sent == fetch.request.size()) fetch.phases.upstream_sent = get_current_time();
+    }
+    return true;
+}
 
-        // receive the actual content from server
-        bytes_read = recv(web_sock, buffer.data(), content_length, MSG_WAITALL);
+// Drain the prefetch's web socket into its flight, passing new bytes on to any followers.
+// Returns false if the fetch failed.
+bool Proxy::readPrefetch(int web_sock, PrefetchFetch& fetch) {
+    SegmentFlight& flight = *fetch.flight;
+    while (true) {
+        ssize_t bytes_read;
+        if (flight.total == 0) {
+            bytes_read = fetch.in.readOnce(web_sock);
+        } else {
+            bytes_read = recv(web_sock, read_buffer.data(), std::min(read_buffer.size(), flight.total - flight.data.size()), 0);
+        }
 
-        // Check if recv read any bytes
         if (bytes_read > 0) {
-            // Null-terminate the buffer to safely print it as a string
-            buffer[bytes_read] = '\0';
-            
-            // Print the number of bytes read and the content
-            std::cout << "[DEBUG] Bytes read: " << bytes_read << std::endl;
-            // std::cout << "[DEBUG] Content: " << buffer << std::endl;
+            if (flight.total > 0) {
+                flight.data.append(read_buffer.data(), bytes_read);
+            } else {
+                if (fetch.phases.first_byte == TimePoint{}) fetch.phases.first_byte = get_current_time();
+                size_t header_len = fetch.in.findHeaderEnd();
+                if (header_len == 0) continue;
+                flight.data = fetch.in.take(header_len);
+                fetch.phases.header_done = get_current_time();
+                fetch.phases.header_body_bytes = std::min(fetch.in.size(), get_content_length(flight.data));
+                fetch.tcp_mark = mark_tcp_rate(web_sock);
+                fetch.content_length = get_content_length(flight.data);
+                if (header_len + fetch.content_length > MAX_COALESCED_SIZE) return false;
+                flight.total = header_len + fetch.content_length;
+                flight.data.reserve(flight.total);
+                flight.data.append(fetch.in.data(), std::min(fetch.in.size(), fetch.content_length));
+                fetch.in.clear();
+            }
+            notifyFollowers(fetch.flight);
+            if (flight.data.size() == flight.total) {
+                endPrefetch(web_sock, true);
+                return true;
+            }
         } else if (bytes_read == 0) {
-            std::cout << "[DEBUG] Connection closed by the server." << std::endl;
+            return false;
+        } else if (errno == EINTR) {
+            continue;
         } else {
-            std::cerr << "[DEBUG] Error in recv: " << strerror(errno) << std::endl;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
         }
+    }
+}
 
-        // std::string request(buffer, valread);
-        std::cout << "[DEBUG] Buffer before send = " << buffer.data() << std::endl;
-
-        // store the content in a string
-        std::string content(buffer.data(), bytes_read);
+// The prefetch on web_sock completed or failed. A complete segment counts as a fetch for
+// its player and waits in the player's prefetch store (or the segment cache) until asked for.
+void Proxy::endPrefetch(int web_sock, bool complete) {
+    auto it = prefetches.find(web_sock);
+    if (it == prefetches.end()) return;
+    PrefetchFetch fetch = std::move(it->second);
+    prefetches.erase(it);
+
+    std::shared_ptr<SegmentFlight> flight = fetch.flight;
+    fetch.phases.body_done = get_current_time();
+    TcpRateSample tcp = complete ? sample_tcp_rate(web_sock, fetch.tcp_mark) : TcpRateSample();
+    if (complete && !is_connection_close(flight->data)) {
+        upstream_pool.release(web_sock);
+    } else {
+        upstream_pool.discard(web_sock);
+    }
+    auto flight_it = in_flight.find(fetch.uri);
+    if (flight_it != in_flight.end() && flight_it->second == flight) in_flight.erase(flight_it);
+    prefetch_stats.bytes_fetched += flight->data.size();
+
+    // followers of a failed prefetch fetch for themselves
+    if (!complete || get_status_code(flight->data) != 200) {
+        std::cout << "[DEBUG] Prefetch of " << fetch.uri << " failed" << std::endl;
+        ++prefetch_stats.failed;
+        prefetch_stats.bytes_wasted += flight->data.size();
+        if (!complete) {
+            flight->failed = true;
+            notifyFollowers(flight);
+        }
+        return;
+    }
 
-        // concatenate the header and content
-        std::string message = header + content;
-        
-        // send
-        ssize_t bytes_sent = send(client_sock, message.c_str(), message.size(), 0);
+    if (segment_cache.isEnabled()) segment_cache.insert(fetch.uri, flight->data);
+    ClientConnection* client = fetch.client_sock >= 0 ? connection_manager.getClient(fetch.client_sock) : nullptr;
+    if (client) {
+        // a prefetch has no client side; the player takes it from memory later
+        recordSegmentFetch(*client, fetch.uri, fetch.content_length, fetch.phases, tcp);
+        logSegmentFetch(fetch.client_sock, *client, fetch.uri, fetch.content_length, fetch.phases, fetch.bitrate);
+    }
 
-        // size_t total_sent = 0;
-        // ssize_t bytes_sent;
+    if (flight->prefetch_claimed) {
+        // the player asked while it was on its way and has been following it
+        ++prefetch_stats.used;
+        prefetch_stats.bytes_used += flight->data.size();
+    } else if (client) {
+        client->storePrefetched(fetch.uri, SegmentCache::Entry(flight, &flight->data));
+    } else {
+        ++prefetch_stats.wasted;
+        prefetch_stats.bytes_wasted += flight->data.size();
+    }
+}
 
-        // while (total_sent < bytes_read) {
-        //     bytes_sent = send(client_sock, buffer + total_sent, bytes_read - total_sent, 0);
-        //     if (bytes_sent == -1) {
-        //         std::cerr << "Error sending data." << std::endl;
-        //     }
-        //     total_sent += bytes_sent;
-        // }
+// Queue header + body for the client and start writing it
+bool Proxy::queueResponse(int client_sock, ClientConnection& client, const std::string& header,
+                          const std::vector<char>& body) {
+    HttpExchange& exchange = client.getExchange();
+    std::string response;
+    response.reserve(header.size() + body.size());
+    response.append(header);
+    response.append(body.begin(), body.end());
+    exchange.response = std::move(response);
+    exchange.response_sent = 0;
+    exchange.state = ExchangeState::WritingResponse;
+    return flushClient(client_sock, client);
+}
 
-        if (bytes_sent == -1) {
+// Send data[sent..] until the client socket is full; returns false on a socket error
+bool Proxy::sendShared(int client_sock, const std::string& data, size_t& sent) {
+    while (sent < data.size()) {
+        ssize_t n = send(client_sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
             std::cerr << "[DEBUG] Error in sending data to client: " << strerror(errno) << std::endl;
-        } else {
-            std::cout << "[DEBUG] " << bytes_sent << " bytes sent to client " << client_sock << std::endl;
+            return false;
         }
+        sent += n;
     }
+    return true;
 }
 
-// Main method to run the proxy
-void Proxy::run() {
-    int master_socket, addrlen, activity, valread;
+// Write as much of the pending response bytes as the client socket accepts: first the
+// user-space queue, then a cached response or anything waiting in the relay pipe
+bool Proxy::writeClient(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+    if (exchange.client_gone) return true;
+    while (exchange.response_sent < exchange.response.size()) {
+        ssize_t sent = send(client_sock, exchange.response.data() + exchange.response_sent,
+                            exchange.response.size() - exchange.response_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            std::cerr << "[DEBUG] Error in sending data to client: " << strerror(errno) << std::endl;
+            return false;
+        }
+        exchange.response_sent += sent;
+    }
 
-    struct sockaddr_in address;
-    master_socket = getMasterSocket(&address);
+    // drop what has been sent so a long relay does not grow the buffer
+    if (exchange.response_sent == exchange.response.size()) {
+        exchange.response.clear();
+        exchange.response_sent = 0;
+    } else if (exchange.response_sent >= RELAY_HIGH_WATER) {
+        exchange.response.erase(0, exchange.response_sent);
+        exchange.response_sent = 0;
+        return true;
+    } else {
+        return true;
+    }
 
-    // char buffer[BUFFER_SIZE]; // data buffer of 1KiB + 1 bytes
-    std::vector<char> buffer(BUFFER_SIZE);
+    // cache hits and followers of another client's fetch are written straight from the shared bytes
+    if (exchange.cached_response) {
+        return sendShared(client_sock, *exchange.cached_response, exchange.cached_sent);
+    }
+    if (exchange.flight && !exchange.flight_leader) {
+        return sendShared(client_sock, exchange.flight->data, exchange.flight_sent);
+    }
 
-    // accept the incoming connection
-    addrlen = sizeof(address);
+#ifdef __linux__
+    while (exchange.pipe_bytes > 0) {
+        ssize_t sent = splice(client.getRelayPipe()[0], nullptr, client_sock, nullptr, exchange.pipe_bytes,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            // the player closed its end; with SIGPIPE ignored this is just a client gone
+            if (errno == EPIPE || errno == ECONNRESET) return false;
+            std::cerr << "[DEBUG] Error in splicing data to client: " << strerror(errno) << std::endl;
+            return false;
+        }
+        exchange.pipe_bytes -= sent;
+    }
+#else
+    (void)client;
+#endif
+    return true;
+}
 
-    // set of socket descriptors
-    fd_set readfds;
+// Client socket became writable (or a response was just queued): push out pending
+// bytes, resume a paused relay, and go back to reading requests once done
+bool Proxy::flushClient(int client_sock, ClientConnection& client) {
+    HttpExchange& exchange = client.getExchange();
+
+    if (exchange.state == ExchangeState::RelayingBody) {
+        if (!writeClient(client_sock, client)) return false;
+        if (exchange.relay_paused && exchange.pendingBytes() < RELAY_LOW_WATER) {
+            // the web socket will not signal again for data it already holds
+            exchange.relay_paused = false;
+            return readUpstream(client_sock, client);
+        }
+        return true;
+    }
 
-    while (true) {
-        // Clear the set of fds (sockets) that the select()
-        FD_ZERO(&readfds);
+    if (exchange.state == ExchangeState::FollowingFetch) {
+        if (exchange.flight->failed) {
+            // the leading client went away; fetch the segment ourselves if nothing was sent yet
+            if (exchange.flight_sent > 0) return false;
+            exchange.flight.reset();
+            return sendUpstream(client_sock, client);
+        }
+        if (!writeClient(client_sock, client)) return false;
+        if (exchange.flight->total == 0 || exchange.flight_sent < exchange.flight->total) return true;
+    } else {
+        if (exchange.state != ExchangeState::WritingResponse) return true;
+        if (!writeClient(client_sock, client)) return false;
+        if (exchange.pendingBytes() > 0) return true;
+    }
 
-        // Adds the listening socket to the set of fds (listen_sock is responsible for accepting
-        // new client connections)
-        FD_SET(master_socket, &readfds);
+    std::cout << "[DEBUG] Response complete for client " << client_sock << std::endl;
+    if (exchange.kind == RequestKind::Segment) client.addBufferedSegment(false, get_current_time());
+    if (exchange.log_pending) {
+        exchange.log_pending = false;
+        exchange.phases.client_done = get_current_time();
+        logSegmentFetch(client_sock, client, exchange.uri, exchange.body_received, exchange.phases, exchange.bitrate);
+    }
+    endFlight(exchange);
+    if (exchange.close_after || exchange.client_gone) return false;
+    exchange.reset();
+
+    // more requests may have arrived while this one was in flight
+    if (exchange.client_read_paused) {
+        exchange.client_read_paused = false;
+        return readClient(client_sock, client);
+    }
+    return startRequest(client_sock, client);
+}
 
-        // Tracks the highest socket fd for use with select(), initially set to listen_sock
-        // int max_sd = master_socket;
+// Main method to run the proxy
+void Proxy::run() {
+    struct sockaddr_in address;
+    master_socket = getMasterSocket(&address);
+    set_nonblocking(master_socket);
 
-        // Adds each connected client's socket to readfds and updates max_sd to ensure select() 
-        // monitors the highest socket number
-        // for (int client_sock : client_sockets) {
-        for (const auto& pair : connection_manager.getClientMap()) {
-            int client_sock = pair.first;
-            if (client_sock != 0) FD_SET(client_sock, &readfds);
-            // if (client_sock > max_sd) {
-            //     max_sd = client_sock;
-            // }
-        }
-
-        // Blocks until there is activity or an error. 
-        // int activity = select(max_sd + 1, &readfds, nullptr, nullptr, nullptr);
-        activity = select(FD_SETSIZE, &readfds, NULL, NULL, NULL);
-        if ((activity < 0) && (errno != EINTR)) {
-            std::cout << "Error in select()\n";
-        }
-
-        // Checks if the listening socket has activity, meaning a new client is trying to connect
-        if (FD_ISSET(master_socket, &readfds)) {
-            // Accepts new client connection
-            int new_sock = accept(master_socket, (struct sockaddr *)&address,
-                              (socklen_t *)&addrlen);
-            // if (new_sock >= 0) {
-            //     // Add new client socket to the list of active client sockets
-            //     // client_sockets.push_back(new_sock);
-            //     addNewClient(new_sock);
-            // }
-
-            if (new_sock < 0) {
-                perror("accept");
-                exit(EXIT_FAILURE);
-            }
+    // the listening socket, client sockets and web sockets are each registered exactly
+    // once; every exchange advances from whichever sockets are ready, so transfers
+    // for many clients overlap on this one thread
+    event_loop.add(master_socket, EPOLLIN, [this](uint32_t) { acceptClients(); });
 
-            // inform user of socket number - used in send and receive commands
-            printf("\n---New host connection---\n");
-            printf("socket fd is %d , ip is : %s , port : %d \n", new_sock,
-                    inet_ntoa(address.sin_addr), ntohs(address.sin_port));
-
-            // add new socket to client_map in the connection_manager
-            // this function also opens a new web socket for the client
-            addNewClient(new_sock);
-            
-            // // Create new socket to connect to the web server
-            // int new_web_sock = socket(AF_INET, SOCK_STREAM, 0);
-
-            // // Sets up the addr and port of the webserver
-            // struct sockaddr_in web_addr;
-            // memset(&web_addr, 0, sizeof(web_addr));
-            // web_addr.sin_family = AF_INET;
-            // web_addr.sin_port = htons(static_cast<uint16_t>(server_port));
-            // inet_pton(AF_INET, server_ip.c_str(), &web_addr.sin_addr);
-            // if (connect(new_web_sock, (struct sockaddr*)&web_addr, sizeof(web_addr)) < 0) {
-            //     log_message("[DEBUG] Failed to open web socket.", log_path);
-            // }
-
-            // connection_manager.setClientWebSockfd(new_sock, new_web_sock);
-        }
-
-        // else it's some IO operation on a client socket
-        std::cout << "[DEBUG] Num client sockets = " << connection_manager.getNumClients() << std::endl;
-        for (const auto& pair : connection_manager.getClientMap()) {
-            int client_sock = pair.first;
-            // If the client socket is valid and ready for reading
-            // NOTE: sd == 0 is our default here by fd 0 is actually stdin
-            if (client_sock != 0 && FD_ISSET(client_sock, &readfds)) {
-                std::cout << "[DEBUG] Reading from client socket " << client_sock << std::endl;
-
-                // Check if it was for closing
-                getpeername(client_sock, (struct sockaddr *)&address,
-                    (socklen_t *)&addrlen);
-
-                // read message from client
-                valread = static_cast<int>(read(client_sock, buffer.data(), BUFFER_SIZE - 1));
-
-                // get the web socket the client is connected to
-                // int web_sock = connection_manager.getClientWebSock(client_sock);
-
-                // // peek at the data without actually removing it from the socket stream
-                // std::cout << "[DEBUG] In buffer before receiving new data = " << buffer << std::endl;
-                // ssize_t bytes_read = recv(client_sock, buffer, sizeof(buffer), MSG_PEEK);
-
-                if (valread == 0) {
-                    // Somebody disconnected , get their details and print
-                    printf("\n---Host disconnected---\n");
-                    printf("Host disconnected , ip %s , port %d \n",
-                            inet_ntoa(address.sin_addr), ntohs(address.sin_port));
-                    
-                    // Close the sockets and remove from map
-                    close(client_sock);
-                    // close(web_sock);
-                    connection_manager.removeClient(client_sock);
-                } else {
-                    // convert buffer to a C++ string (no need for null termination)
-                    std::string request(buffer.data(), valread);
-                    std::cout << "Received request: " << request << std::endl;
-                    handleClientRequest(client_sock, request);
-                }
-
-                // if (bytes_read > 0) {
-                //     // Data received from the client, handle it
-                //     // buffer[bytes_read] = '\0';  // Null-terminate the buffer if it's a string
-                //     // std::cout << "Received data: " << buffer << std::endl;
-
-                //     // Check if it was for closing, and also read the incoming message
-                //     std::string header = "";
-                //     if (read_http_header(client_sock, header) <= 0) {
-                //         std::cout << "[DEBUG] No bytes read into header." << std::endl;
-                //     }
-
-                //     // handle the client request accordingly
-                //     handleClientRequest(client_sock, web_sock, header);
-                // } else if (bytes_read == 0) {
-                //     // Connection closed by the client
-                //     std::cout << "[DEBUG] Client closed the connection." << std::endl;
-                //     close(client_sock);
-                //     close(web_sock);
-                //     connection_manager.removeClient(client_sock);
-                // } else {
-                //     // An error occurred
-                //     std::cerr << "Error receiving data: " << strerror(errno) << std::endl;
-                //     if (errno == ECONNRESET) {
-                //         // Connection reset by peer
-                //         std::cout << "Connection reset by the client." << std::endl;
-                //     }
-                //     close(client_sock);
-                //     close(web_sock);
-                // }
-            }
-        }
+    while (true) {
+        event_loop.poll(TICK_MS);
+        servePendingUpstream();
+        onTick();
     }
-}
\ No newline at end of file
+}
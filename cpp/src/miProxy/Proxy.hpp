@@ -2,16 +2,30 @@
 #define PROXY_HPP
 
 #include "Connection.hpp"
+#include "Abr.hpp"
 #include "BitrateManager.hpp"
 #include "Logger.hpp"
+#include "EventLoop.hpp"
+#include "UpstreamPool.hpp"
+#include "ProxyOptions.hpp"
+#include "Prefetch.hpp"
+#include "PlayerSession.hpp"
+#include "SegmentCache.hpp"
+#include "ThroughputPriors.hpp"
+#include <deque>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class Proxy {
 public:
-    // Constructor
-    Proxy(int listen_port, const std::string& server_ip, int server_port, double alpha, Logger &logger);
+    // Constructor; bitrate_manager, segment_cache, throughput_priors and session_table are
+    // shared by all workers of the process
+    Proxy(int listen_port, const std::string& server_ip, int server_port, double alpha, Logger &logger,
+          BitrateManager &bitrate_manager, SegmentCache &segment_cache, ThroughputPriors &throughput_priors,
+          SessionTable &session_table, const ProxyOptions &options);
 
     // Destructor
     ~Proxy();
@@ -19,14 +33,63 @@ public:
     // Getters
     BitrateManager& getBitrateManager();
 
-    // Main method to run the proxy
+    // Main method to run the proxy; each worker thread runs its own Proxy
     void run();
 
 private:
     // Helper methods
-    void handleClientRequest(int client_sock, std::string &header);
-    void addNewClient(int client_fd);
+    void addNewClient(int client_fd, const in_addr& client_addr);
     void removeClient(int client_fd);
+    void acceptClients();
+    void closeClient(int client_sock);
+    void closeWebSock(ClientConnection& client);
+    void releaseWebSock(ClientConnection& client);
+    bool attachWebSock(int client_sock, ClientConnection& client);
+    bool retryUpstream(int client_sock, ClientConnection& client);
+    void servePendingUpstream();
+    void onTick();
+
+    // Event handlers for client and web server sockets
+    void onClientEvent(int client_sock, uint32_t events);
+    void onUpstreamEvent(int client_sock, int web_sock, uint32_t events);
+
+    // Steps of the per-connection exchange state machine (return false to close the client)
+    bool readClient(int client_sock, ClientConnection& client);
+    bool startRequest(int client_sock, ClientConnection& client);
+    bool sendUpstream(int client_sock, ClientConnection& client);
+    bool flushUpstream(ClientConnection& client);
+    bool readUpstream(int client_sock, ClientConnection& client);
+    bool onUpstreamHeader(int client_sock, ClientConnection& client);
+    bool onUpstreamData(int client_sock, ClientConnection& client, const char* data, size_t len);
+    bool relayToClient(int client_sock, ClientConnection& client, const char* data, size_t len);
+    ssize_t spliceFromUpstream(int client_sock, ClientConnection& client, size_t len);
+    bool onSplicedData(int client_sock, ClientConnection& client, size_t len);
+    bool finishUpstreamResponse(int client_sock, ClientConnection& client);
+    void recordSegmentFetch(ClientConnection& client, const std::string& uri, size_t bytes,
+                            const RequestPhases& phases, const TcpRateSample& tcp);
+    void logSegmentFetch(int client_sock, ClientConnection& client, const std::string& uri, size_t bytes,
+                         const RequestPhases& phases, int bitrate);
+    void recordBeacon(ClientConnection& client, const HttpRequest& request);
+    void joinSession(ClientConnection& client, const std::string& uri);
+    bool serveCached(int client_sock, ClientConnection& client, SegmentCache::Entry cached);
+    bool serveManifest(int client_sock, ClientConnection& client, const BitrateManager::Manifest& manifest);
+    bool followFlight(int client_sock, ClientConnection& client, std::shared_ptr<SegmentFlight> flight);
+    void notifyFollowers(const std::shared_ptr<SegmentFlight>& flight);
+    bool keepFetchingForFollowers(HttpExchange& exchange);
+    void endFlight(HttpExchange& exchange);
+
+    // Segments fetched ahead of the players' requests
+    void schedulePrefetch(int client_sock, ClientConnection& client);
+    void startPrefetch(int client_sock, const std::string& uri, int bitrate);
+    void onPrefetchEvent(int web_sock, uint32_t events);
+    bool flushPrefetch(int web_sock, PrefetchFetch& fetch);
+    bool readPrefetch(int web_sock, PrefetchFetch& fetch);
+    void endPrefetch(int web_sock, bool complete);
+    bool queueResponse(int client_sock, ClientConnection& client, const std::string& header,
+                       const std::vector<char>& body);
+    bool sendShared(int client_sock, const std::string& data, size_t& sent);
+    bool writeClient(int client_sock, ClientConnection& client);
+    bool flushClient(int client_sock, ClientConnection& client);
 
     // Member variables
     int listen_port;
@@ -34,21 +97,64 @@ private:
     int server_port;
     double alpha;
     std::string log_path;
-    int web_sock;
+    int master_socket;
     Logger &logger;
 
-    // Managers for connections and bitrates
+    // Reactor driving the listening socket, client sockets and web sockets
+    EventLoop event_loop;
+    std::vector<char> read_buffer;  // Scratch buffer shared by all socket reads
+
+    // Keep-alive connections to the web server, and clients waiting for one
+    UpstreamPool upstream_pool;
+    std::deque<int> pending_upstream;
+
+    // Relay segment bodies with splice() (turned off if the system lacks it)
+    bool splice_enabled;
+
+    // Managers for connections (owned by this worker) and bitrates (shared)
     ConnectionManager connection_manager;
-    BitrateManager bitrate_manager;
+    BitrateManager &bitrate_manager;
+
+    // Rule picking each segment's bitrate, and what its decisions cost
+    AbrPolicy abr_policy;
+    AbrStats abr_stats;
+
+    // Complete segment responses served without the web server (shared)
+    SegmentCache &segment_cache;
+
+    // Throughput last seen from each client address and subnet, seeding new connections (shared)
+    ThroughputPriors &throughput_priors;
+
+    // Players' ABR state by client address and manifest, kept across their connections (shared)
+    SessionTable &session_table;
+
+    // Share of the kernel's TCP_INFO rate in each segment's throughput sample; the rest is
+    // the wall-clock rate
+    double tcp_info_weight;
+
+    // Phase durations of the segments fetched from the web server, and whether the chunk
+    // log shows them
+    bool log_phases;
+    PhaseHistograms phase_histograms;
+
+    // Seconds a manifest is served from bitrate_manager before asking the web server again
+    double manifest_ttl;
+
+    // Segment fetches in progress on this worker, by rewritten URI, for clients to join
+    std::unordered_map<std::string, std::shared_ptr<SegmentFlight>> in_flight;
+
+    // Segments fetched ahead of the players, by web socket, and how useful they turned out
+    size_t prefetch_depth;
+    std::unordered_map<int, PrefetchFetch> prefetches;
+    PrefetchStats prefetch_stats;
+
+    TimePoint last_stats_time;  // When counters were last reported
 
     // Method to create the listening socket
     // int createListeningSocket();
 
     // function from select discussion code
     int getMasterSocket(struct sockaddr_in *address);
-
-    // open new connection to the web server
-    int openWebSock();
 };
 
 #endif  // PROXY_HPP
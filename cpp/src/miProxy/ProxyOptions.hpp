@@ -0,0 +1,24 @@
+#ifndef PROXY_OPTIONS_HPP
+#define PROXY_OPTIONS_HPP
+
+#include <string>
+
+// Optional tuning knobs given after the required miProxy arguments
+struct ProxyOptions {
+    int workers = 1;                 // Number of event loop threads sharing the listen port
+    size_t pool_size = 64;           // Max upstream connections per origin, per worker
+    double pool_idle_timeout = 4.0;  // Seconds an idle upstream connection is kept open
+    bool splice = true;              // Relay segment bodies with splice() where available
+    size_t cache_size = 64 << 20;    // Bytes of segment responses cached in memory (0 disables)
+    double manifest_ttl = 5.0;       // Seconds a fetched manifest is served from memory before revalidation
+    size_t max_titles = 1024;        // Titles whose ladder and manifest are kept in memory (least recently used go first)
+    std::string abr_policy = "throughput";  // ABR policy picking segment bitrates ("throughput" or "buffer")
+    size_t prefetch_depth = 0;       // Segments fetched ahead of each player (0 disables)
+    int prior_prefix = 24;           // Prefix length of the subnets sharing throughput priors
+    double prior_half_life = 60.0;   // Seconds for a remembered throughput to halve (0 disables priors)
+    double session_timeout = 60.0;   // Seconds a player session outlives its last connection (0 disables sessions)
+    bool log_phases = false;         // Append per-phase durations to each chunk log line
+    double tcp_info_weight = 0.5;    // Share of the TCP_INFO rate in each throughput sample (0 uses timing only)
+};
+
+#endif  // PROXY_OPTIONS_HPP
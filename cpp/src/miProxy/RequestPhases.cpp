@@ -0,0 +1,62 @@
+#include "RequestPhases.hpp"
+#include "BitrateManager.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Shortest body phase worth timing (seconds)
+constexpr double MIN_BODY_PHASE = 0.001;
+
+// Seconds from start to end, or -1 if either phase did not happen
+static double phase_duration(const TimePoint& start, const TimePoint& end) {
+    if (start == TimePoint{} || end == TimePoint{}) return -1.0;
+    return calculate_duration(start, end);
+}
+
+ChunkPhases RequestPhases::durations() const {
+    return {phase_duration(request_read, upstream_sent), phase_duration(upstream_sent, first_byte),
+            phase_duration(first_byte, header_done), phase_duration(header_done, body_done),
+            phase_duration(body_done, client_done)};
+}
+
+double RequestPhases::bodyThroughput(size_t body_bytes, double& duration) const {
+    duration = phase_duration(header_done, body_done);
+    if (duration >= MIN_BODY_PHASE && body_bytes > header_body_bytes) {
+        return calculate_throughput(body_bytes - header_body_bytes, duration);
+    }
+    duration = phase_duration(upstream_sent, body_done);
+    return calculate_throughput(body_bytes, duration);
+}
+
+void LatencyHistogram::record(double seconds) {
+    double us = std::max(seconds * 1e6, 1.0);
+    size_t bucket = std::min(static_cast<size_t>(std::log2(us)), NUM_BUCKETS - 1);
+    ++buckets[bucket];
+    ++count;
+    max_ms = std::max(max_ms, seconds * 1000);
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    return count;
+}
+
+double LatencyHistogram::getPercentile(double quantile) const {
+    uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank && seen > 0) return std::min(std::ldexp(1.0, i + 1) / 1000, max_ms);
+    }
+    return max_ms;
+}
+
+double LatencyHistogram::getMax() const {
+    return max_ms;
+}
+
+void PhaseHistograms::record(const ChunkPhases& phases) {
+    if (phases.queue >= 0) queue.record(phases.queue);
+    if (phases.ttfb >= 0) ttfb.record(phases.ttfb);
+    if (phases.header >= 0) header.record(phases.header);
+    if (phases.body >= 0) body.record(phases.body);
+    if (phases.client >= 0) client.record(phases.client);
+}
@@ -0,0 +1,59 @@
+#ifndef REQUEST_PHASES_HPP
+#define REQUEST_PHASES_HPP
+
+#include "common.hpp"
+#include "Logger.hpp"
+#include <array>
+#include <cstdint>
+
+// When each phase of a proxied segment request ended. Phases that did not happen (a
+// prefetch has no client side) keep the default TimePoint.
+struct RequestPhases {
+    TimePoint request_read;   // Complete request read from the client
+    TimePoint upstream_sent;  // Request fully written to the web server
+    TimePoint first_byte;     // First byte of the response header arrived
+    TimePoint header_done;    // Response header complete
+    TimePoint body_done;      // Last body byte arrived
+    TimePoint client_done;    // Response fully written to the client
+    size_t header_body_bytes = 0;  // Body bytes that arrived along with the header
+
+    // Duration of each phase, for the chunk log and the histograms
+    ChunkPhases durations() const;
+
+    // Throughput (Kbps) of the body phase alone, so origin latency and a slow client stay
+    // out of the estimate. A body that came in with its header is too quick to time; it
+    // is measured from the request instead. duration is set to the interval used.
+    double bodyThroughput(size_t body_bytes, double& duration) const;
+};
+
+// Log-scale histogram of phase durations: bucket i counts durations in [2^i, 2^(i+1)) us
+class LatencyHistogram {
+public:
+    void record(double seconds);
+
+    uint64_t getCount() const;
+
+    // Upper bound of the bucket holding the given quantile (0-1), in ms
+    double getPercentile(double quantile) const;
+
+    double getMax() const;  // ms
+
+private:
+    static constexpr size_t NUM_BUCKETS = 32;
+    std::array<uint64_t, NUM_BUCKETS> buckets{};
+    uint64_t count = 0;
+    double max_ms = 0.0;
+};
+
+// Latency histograms of every phase of the segments fetched from the web server
+struct PhaseHistograms {
+    LatencyHistogram queue;   // Request read until written to the web server (pool wait)
+    LatencyHistogram ttfb;    // Request written until the first response byte (origin latency)
+    LatencyHistogram header;  // First byte until the header is complete
+    LatencyHistogram body;    // Header complete until the last body byte (upstream bandwidth)
+    LatencyHistogram client;  // Last body byte until the client has it all (slow clients)
+
+    void record(const ChunkPhases& phases);
+};
+
+#endif  // REQUEST_PHASES_HPP
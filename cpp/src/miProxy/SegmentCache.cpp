@@ -0,0 +1,76 @@
+#include "SegmentCache.hpp"
+
+// A single response may take at most this fraction of the budget
+constexpr size_t MAX_ENTRY_FRACTION = 8;
+
+// Constructor
+SegmentCache::SegmentCache(size_t capacity) : capacity(capacity), last_report(get_current_time()) {}
+
+bool SegmentCache::isEnabled() const {
+    return capacity > 0;
+}
+
+size_t SegmentCache::getMaxEntrySize() const {
+    return capacity / MAX_ENTRY_FRACTION;
+}
+
+SegmentCache::Entry SegmentCache::lookup(const std::string& uri) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(uri);
+    if (it == index.end()) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    lru.splice(lru.begin(), lru, it->second);
+    ++stats.hits;
+    stats.bytes_saved += it->second->response->size();
+    return it->second->response;
+}
+
+bool SegmentCache::contains(const std::string& uri) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.count(uri) > 0;
+}
+
+void SegmentCache::insert(const std::string& uri, std::string response) {
+    size_t size = response.size();
+    if (size > getMaxEntrySize()) return;
+    auto entry = std::make_shared<const std::string>(std::move(response));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(uri);
+    if (it != index.end()) {
+        // another client fetched the same segment meanwhile; keep the newer copy
+        stats.bytes_used -= it->second->response->size();
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    evictFor(size);
+    lru.push_front({uri, std::move(entry)});
+    index.emplace(uri, lru.begin());
+    stats.bytes_used += size;
+    stats.entries = lru.size();
+    ++stats.insertions;
+}
+
+bool SegmentCache::takeStatsReport(double interval, SegmentCacheStats& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    TimePoint now = get_current_time();
+    if (calculate_duration(last_report, now) < interval) return false;
+    last_report = now;
+    out = stats;
+    return true;
+}
+
+// Drop least recently used responses until size more bytes fit (caller holds the lock)
+void SegmentCache::evictFor(size_t size) {
+    while (!lru.empty() && stats.bytes_used + size > capacity) {
+        stats.bytes_used -= lru.back().response->size();
+        index.erase(lru.back().uri);
+        lru.pop_back();
+        ++stats.evictions;
+    }
+    stats.entries = lru.size();
+}
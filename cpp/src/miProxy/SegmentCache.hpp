@@ -0,0 +1,67 @@
+#ifndef SEGMENT_CACHE_HPP
+#define SEGMENT_CACHE_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Counters describing how well the segment cache works
+struct SegmentCacheStats {
+    uint64_t hits = 0;         // Segment requests answered from the cache
+    uint64_t misses = 0;       // Segment requests that went to the web server
+    uint64_t insertions = 0;   // Responses stored
+    uint64_t evictions = 0;    // Responses dropped to stay within the byte budget
+    uint64_t bytes_saved = 0;  // Response bytes served without touching the web server
+    size_t bytes_used = 0;     // Bytes currently cached
+    size_t entries = 0;        // Responses currently cached
+};
+
+// Byte-budgeted LRU cache of complete segment responses (header + body), keyed by the
+// rewritten segment URI and shared by all workers. Entries are immutable and handed out
+// as shared_ptrs, so a hit is written to the client straight out of the cache.
+class SegmentCache {
+public:
+    using Entry = std::shared_ptr<const std::string>;
+
+    // Constructor; a capacity of 0 disables the cache
+    explicit SegmentCache(size_t capacity);
+
+    bool isEnabled() const;
+
+    // Largest response worth capturing for the cache
+    size_t getMaxEntrySize() const;
+
+    // Cached response for uri (moved to the front of the LRU list), or nullptr
+    Entry lookup(const std::string& uri);
+
+    // Whether uri is cached, without counting a lookup or touching the LRU order
+    bool contains(const std::string& uri);
+
+    // Store a complete response, evicting the least recently used ones to make room
+    void insert(const std::string& uri, std::string response);
+
+    // Copy the counters if at least interval seconds passed since the last report, so
+    // only one of the workers sharing the cache logs them
+    bool takeStatsReport(double interval, SegmentCacheStats& stats);
+
+private:
+    struct Node {
+        std::string uri;
+        Entry response;
+    };
+
+    void evictFor(size_t size);
+
+    const size_t capacity;
+    std::mutex mutex;
+    std::list<Node> lru;  // Most recently used first
+    std::unordered_map<std::string, std::list<Node>::iterator> index;
+    SegmentCacheStats stats;
+    TimePoint last_report;
+};
+
+#endif  // SEGMENT_CACHE_HPP
@@ -0,0 +1,66 @@
+#include "ThroughputPriors.hpp"
+#include <cmath>
+
+// Constructor
+ThroughputPriors::ThroughputPriors(int prefix_length, double half_life, size_t capacity)
+    : prefix_length(prefix_length), half_life(half_life), capacity(capacity) {
+    index.reserve(capacity);
+}
+
+bool ThroughputPriors::isEnabled() const {
+    return half_life > 0 && capacity > 0;
+}
+
+double ThroughputPriors::lookup(const in_addr& addr) {
+    if (!isEnabled()) return 0.0;
+    TimePoint now = get_current_time();
+
+    // the client's own history beats its neighbours'
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int length : {32, prefix_length}) {
+        auto it = index.find(makeKey(addr, length));
+        if (it == index.end()) continue;
+        lru.splice(lru.begin(), lru, it->second);
+        return decayed(*it->second, now);
+    }
+    return 0.0;
+}
+
+void ThroughputPriors::update(const in_addr& addr, double throughput, double alpha) {
+    if (!isEnabled() || throughput <= 0) return;
+    TimePoint now = get_current_time();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    store(makeKey(addr, 32), throughput, 1.0, now);
+    if (prefix_length < 32) store(makeKey(addr, prefix_length), throughput, alpha, now);
+}
+
+uint64_t ThroughputPriors::makeKey(const in_addr& addr, int length) const {
+    uint32_t mask = length <= 0 ? 0 : ~uint32_t(0) << (32 - length);
+    return (static_cast<uint64_t>(length) << 32) | (ntohl(addr.s_addr) & mask);
+}
+
+// The estimate, halved for every half_life it has gone without an update
+double ThroughputPriors::decayed(const Node& node, TimePoint now) const {
+    return node.throughput * std::exp2(-calculate_duration(node.updated, now) / half_life);
+}
+
+// Move the estimate under key towards throughput by alpha, adding it if it is new and
+// evicting the least recently used one beyond capacity (caller holds the lock)
+void ThroughputPriors::store(uint64_t key, double throughput, double alpha, TimePoint now) {
+    auto it = index.find(key);
+    if (it != index.end()) {
+        Node& node = *it->second;
+        node.throughput = alpha * throughput + (1 - alpha) * decayed(node, now);
+        node.updated = now;
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    if (lru.size() >= capacity) {
+        index.erase(lru.back().key);
+        lru.pop_back();
+    }
+    lru.push_front({key, throughput, now});
+    index.emplace(key, lru.begin());
+}
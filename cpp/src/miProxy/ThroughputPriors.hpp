@@ -0,0 +1,52 @@
+#ifndef THROUGHPUT_PRIORS_HPP
+#define THROUGHPUT_PRIORS_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <netinet/in.h>
+#include <unordered_map>
+
+// Default number of client addresses and subnets remembered
+constexpr size_t DEFAULT_PRIOR_ENTRIES = 16384;
+
+// Last known throughput of each client address and of each subnet (by a configurable
+// prefix length), shared by all workers. A new connection starts from its address's
+// estimate, or its subnet's, instead of from zero, so a reconnecting or neighbouring
+// player does not ramp up from the lowest bitrate again. Estimates halve every
+// half_life seconds they go without an update, and the table is an LRU of bounded size.
+class ThroughputPriors {
+public:
+    // Constructor; a half_life of 0 disables the priors
+    ThroughputPriors(int prefix_length, double half_life, size_t capacity = DEFAULT_PRIOR_ENTRIES);
+
+    bool isEnabled() const;
+
+    // Throughput (Kbps) to seed a new connection from addr with, or 0 if nothing is known
+    double lookup(const in_addr& addr);
+
+    // Record the current estimate of a client at addr; the subnet's estimate moves towards
+    // it by alpha, as the clients' own moving averages do
+    void update(const in_addr& addr, double throughput, double alpha);
+
+private:
+    struct Node {
+        uint64_t key;  // Prefix length in the upper 32 bits, masked address in the lower
+        double throughput;
+        TimePoint updated;
+    };
+
+    uint64_t makeKey(const in_addr& addr, int length) const;
+    double decayed(const Node& node, TimePoint now) const;
+    void store(uint64_t key, double throughput, double alpha, TimePoint now);
+
+    const int prefix_length;
+    const double half_life;
+    const size_t capacity;
+    std::mutex mutex;
+    std::list<Node> lru;  // Most recently updated or looked up first
+    std::unordered_map<uint64_t, std::list<Node>::iterator> index;
+};
+
+#endif  // THROUGHPUT_PRIORS_HPP
@@ -0,0 +1,154 @@
+#include "UpstreamPool.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "spdlog/spdlog.h"
+
+// Backoff after a failed connect doubles from the minimum up to the maximum
+constexpr double MIN_BACKOFF = 0.1;  // Seconds
+constexpr double MAX_BACKOFF = 5.0;  // Seconds
+
+// Constructor
+UpstreamPool::UpstreamPool(EventLoop& event_loop, size_t max_per_origin, double idle_timeout)
+    : event_loop(event_loop), max_per_origin(max_per_origin), idle_timeout(idle_timeout) {}
+
+// Destructor
+UpstreamPool::~UpstreamPool() {
+    for (const auto& pair : connections) {
+        event_loop.remove(pair.first);
+        close(pair.first);
+    }
+}
+
+std::string UpstreamPool::makeKey(const std::string& ip, int port) {
+    return ip + ":" + std::to_string(port);
+}
+
+int UpstreamPool::acquireIdle(const std::string& ip, int port) {
+    auto it = origins.find(makeKey(ip, port));
+    if (it == origins.end() || it->second.idle.empty()) return -1;
+
+    // most recently released first: it is the least likely to have been closed by the server
+    int fd = it->second.idle.back().first;
+    it->second.idle.pop_back();
+    event_loop.setHandler(fd, [](uint32_t) {});
+    stats.hits++;
+    return fd;
+}
+
+bool UpstreamPool::canOpen(const std::string& ip, int port) const {
+    auto it = origins.find(makeKey(ip, port));
+    if (it == origins.end()) return max_per_origin > 0;
+    const Origin& origin = it->second;
+    return origin.open_count < max_per_origin &&
+           (origin.consecutive_failures == 0 || get_current_time() >= origin.retry_at);
+}
+
+int UpstreamPool::open(const std::string& ip, int port) {
+    std::string key = makeKey(ip, port);
+    Origin& origin = origins[key];
+    stats.misses++;
+
+    // Create new socket to connect to the web server
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        spdlog::error("Failed to create web socket: {}", strerror(errno));
+        return -1;
+    }
+
+    // Sets up the addr and port of the webserver
+    struct sockaddr_in web_addr;
+    memset(&web_addr, 0, sizeof(web_addr));
+    web_addr.sin_family = AF_INET;
+    web_addr.sin_port = htons(static_cast<uint16_t>(port));
+    inet_pton(AF_INET, ip.c_str(), &web_addr.sin_addr);
+    if (connect(fd, (struct sockaddr*)&web_addr, sizeof(web_addr)) < 0 && errno != EINPROGRESS) {
+        spdlog::debug("Failed to open web socket to {}: {}", key, strerror(errno));
+        close(fd);
+        backOff(origin, key);
+        return -1;
+    }
+
+    origin.open_count++;
+    connections[fd] = Connection{key, get_current_time()};
+    event_loop.add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [](uint32_t) {});
+    return fd;
+}
+
+void UpstreamPool::connectFinished(int fd, bool success) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+    Origin& origin = origins[it->second.origin];
+
+    if (success) {
+        double connect_ms = calculate_duration(it->second.connect_start, get_current_time()) * 1000;
+        stats.connects++;
+        stats.total_connect_ms += connect_ms;
+        stats.max_connect_ms = std::max(stats.max_connect_ms, connect_ms);
+        origin.consecutive_failures = 0;
+        return;
+    }
+
+    backOff(origin, it->second.origin);
+    discard(fd);
+}
+
+// Record a failed connect and hold off new connects to the origin
+void UpstreamPool::backOff(Origin& origin, const std::string& key) {
+    stats.connect_failures++;
+    origin.consecutive_failures++;
+    double backoff = std::min(MAX_BACKOFF, MIN_BACKOFF * (1 << std::min(origin.consecutive_failures - 1, 6)));
+    origin.retry_at = get_current_time() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                               std::chrono::duration<double>(backoff));
+    spdlog::debug("Connect to {} failed, backing off {:.1f}s", key, backoff);
+}
+
+void UpstreamPool::release(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+
+    // while idle, readability means the server closed the connection or sent garbage
+    event_loop.setHandler(fd, [this, fd](uint32_t events) {
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) discard(fd);
+    });
+    origins[it->second.origin].idle.emplace_back(fd, get_current_time());
+}
+
+void UpstreamPool::discard(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+
+    Origin& origin = origins[it->second.origin];
+    origin.open_count--;
+    auto idle_it = std::find_if(origin.idle.begin(), origin.idle.end(),
+                                [fd](const std::pair<int, TimePoint>& entry) { return entry.first == fd; });
+    if (idle_it != origin.idle.end()) origin.idle.erase(idle_it);
+
+    connections.erase(it);
+    event_loop.remove(fd);
+    close(fd);
+}
+
+void UpstreamPool::reapIdle() {
+    TimePoint now = get_current_time();
+    std::vector<int> expired;
+    for (const auto& pair : origins) {
+        // idle lists are ordered by release time, oldest first
+        for (const auto& entry : pair.second.idle) {
+            if (calculate_duration(entry.second, now) < idle_timeout) break;
+            expired.push_back(entry.first);
+        }
+    }
+    for (int fd : expired) {
+        discard(fd);
+        stats.reaped++;
+    }
+}
+
+const UpstreamPoolStats& UpstreamPool::getStats() const {
+    return stats;
+}
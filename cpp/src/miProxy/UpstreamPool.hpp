@@ -0,0 +1,84 @@
+#ifndef UPSTREAM_POOL_HPP
+#define UPSTREAM_POOL_HPP
+
+#include "EventLoop.hpp"
+#include "common.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counters describing how well upstream connections are reused
+struct UpstreamPoolStats {
+    uint64_t hits = 0;              // Requests served on an idle pooled connection
+    uint64_t misses = 0;            // Requests that had to open a new connection
+    uint64_t connects = 0;          // Connects that completed successfully
+    uint64_t connect_failures = 0;  // Connects that failed (trigger backoff)
+    uint64_t reaped = 0;            // Idle connections closed after the idle timeout
+    double total_connect_ms = 0.0;  // Sum of connect latencies, for the average
+    double max_connect_ms = 0.0;    // Slowest connect seen
+};
+
+// Per-worker pool of keep-alive connections to the web servers, keyed by origin
+// ("ip:port"). Idle connections stay registered with the event loop so a server
+// closing them is noticed; connects that fail put the origin into exponential
+// backoff before the next attempt.
+class UpstreamPool {
+public:
+    // Constructor
+    UpstreamPool(EventLoop& event_loop, size_t max_per_origin, double idle_timeout);
+
+    // Destructor (closes every pooled connection)
+    ~UpstreamPool();
+
+    // Take an idle connection to ip:port; -1 if none is idle. The caller routes its
+    // events with EventLoop::setHandler.
+    int acquireIdle(const std::string& ip, int port);
+
+    // Whether a new connection to ip:port may be opened now (below the limit, not backing off)
+    bool canOpen(const std::string& ip, int port) const;
+
+    // Start a non-blocking connect to ip:port; -1 on failure. The new fd is registered
+    // with the event loop and the caller routes its events with EventLoop::setHandler.
+    int open(const std::string& ip, int port);
+
+    // Report the outcome of a connect started by open()
+    void connectFinished(int fd, bool success);
+
+    // Return a healthy connection with no request in flight to the idle list
+    void release(int fd);
+
+    // Close a connection that cannot be reused
+    void discard(int fd);
+
+    // Close connections idle for longer than the idle timeout
+    void reapIdle();
+
+    const UpstreamPoolStats& getStats() const;
+
+private:
+    struct Origin {
+        std::vector<std::pair<int, TimePoint>> idle;  // Idle fds with the time they were released (LIFO)
+        size_t open_count = 0;                        // Connections open (idle, busy or connecting)
+        int consecutive_failures = 0;                 // Failed connects since the last success
+        TimePoint retry_at;                           // No new connects before this time
+    };
+
+    struct Connection {
+        std::string origin;      // Key of the Origin this connection belongs to
+        TimePoint connect_start; // When connect() was issued
+    };
+
+    static std::string makeKey(const std::string& ip, int port);
+    void backOff(Origin& origin, const std::string& key);
+
+    EventLoop& event_loop;
+    size_t max_per_origin;
+    double idle_timeout;  // Seconds
+
+    std::unordered_map<std::string, Origin> origins;
+    std::unordered_map<int, Connection> connections;  // Map of every open fd to its origin
+    UpstreamPoolStats stats;
+};
+
+#endif  // UPSTREAM_POOL_HPP
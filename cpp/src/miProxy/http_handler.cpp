@@ -1,10 +1,11 @@
 #include "http_handler.hpp"
-#include <sstream>
 #include <iostream>
 #include <unistd.h>
 #include <string>
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <cerrno>
 
 // Helper function to find the Content-Length header and return its value
 size_t get_content_length(const std::string& response) {
@@ -22,52 +23,94 @@ size_t get_content_length(const std::string& response) {
     return content_length;
 }
 
-// Parses the HTTP request and returns the requested URI
-// The parsing is simplified to extract only the URI
-std::string get_http_uri(const std::string& request) {
-    std::cout << "[DEBUG] Original request = " << request << std::endl;
-    size_t uri_start = request.find("GET ") + 4;
-    size_t uri_end = request.find(" ", uri_start);
-
-    // Return the URI (e.g., /path/to/resource)
-    if (uri_start != std::string::npos && uri_end != std::string::npos) {
-        return request.substr(uri_start, uri_end - uri_start);
+// Returns the header with its Content-Length set to length (added if missing)
+std::string set_content_length(const std::string& header, size_t length) {
+    std::string value = std::to_string(length);
+    size_t line_start = header.find("\r\n");
+    size_t header_end = header.find("\r\n\r\n");
+    while (line_start != std::string::npos && line_start < header_end) {
+        line_start += 2;
+        size_t line_end = header.find("\r\n", line_start);
+        size_t colon = header.find(':', line_start);
+        if (colon < line_end && colon - line_start == 14 &&
+            std::equal(header.begin() + line_start, header.begin() + colon, "content-length",
+                       [](char ch1, char ch2) { return std::tolower(ch1) == ch2; })) {
+            return header.substr(0, colon) + ": " + value + header.substr(line_end);
+        }
+        line_start = line_end;
     }
-    
-    return "";  // Return empty if parsing fails
+    if (header_end == std::string::npos) return header;
+    return header.substr(0, header_end) + "\r\nContent-Length: " + value + header.substr(header_end);
 }
 
-ssize_t read_http_header(int read_sock, std::string &header) {
-    char byte;
-    ssize_t bytes_read;
-    std::string recent_chars;
-    while (true) {
-        // Read a single byte from the socket
-        bytes_read = read(read_sock, &byte, 1);
+// Returns the status code of an HTTP response, or 0 if the status line is malformed
+int get_status_code(const std::string& response) {
+    size_t code_start = response.find(' ');
+    if (code_start == std::string::npos || code_start + 4 > response.size()) return 0;
+    int code = 0;
+    for (size_t i = code_start + 1; i < code_start + 4; ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(response[i]))) return 0;
+        code = code * 10 + (response[i] - '0');
+    }
+    return code;
+}
 
-        // Check if the client has closed the connection or an error occurred
-        if (bytes_read <= 0) {
-            std::cout << "[DEBUG] " << bytes_read << " bytes read. Client closed connection." << std::endl; 
-            return -1;
+// Returns the value of the named header (case-insensitive), or "" if absent
+std::string get_header_value(const std::string& message, const std::string& name) {
+    size_t header_end = message.find("\r\n\r\n");
+    size_t line_start = message.find("\r\n");
+    while (line_start != std::string::npos && line_start < header_end) {
+        line_start += 2;
+        size_t line_end = message.find("\r\n", line_start);
+        if (line_end == std::string::npos) break;
+
+        // compare the field name, ignoring case
+        size_t colon = message.find(':', line_start);
+        if (colon != std::string::npos && colon < line_end && colon - line_start == name.size() &&
+            std::equal(name.begin(), name.end(), message.begin() + line_start,
+                       [](char ch1, char ch2) { return std::tolower(ch1) == std::tolower(ch2); })) {
+            size_t value_start = message.find_first_not_of(" \t", colon + 1);
+            if (value_start == std::string::npos || value_start > line_end) return "";
+            size_t value_end = line_end;
+            while (value_end > value_start && (message[value_end - 1] == ' ' || message[value_end - 1] == '\t')) {
+                --value_end;
+            }
+            return message.substr(value_start, value_end - value_start);
         }
+        line_start = line_end;
+    }
+    return "";
+}
 
-        // Append the byte to the header string
-        header += byte;
-        // std::cout << "[DEBUG] Current header = " << header << std::endl;
+// Whether the message asks for the connection to be closed after it
+bool is_connection_close(const std::string& message) {
+    std::string value = get_header_value(message, "Connection");
+    std::transform(value.begin(), value.end(), value.begin(), [](char ch) { return std::tolower(ch); });
+    return value == "close";
+}
 
-        // Update the recent characters buffer
-        recent_chars += byte;
-        if (recent_chars.size() > 4) {
-            recent_chars.erase(0, 1); // Keep only the last four characters
-        }
+// Returns the requested URI (e.g., /path/to/resource) of a parsed request
+std::string get_http_uri(const HttpRequest& request) {
+    return std::string(request.uri);
+}
+
+ssize_t read_http_header(int read_sock, HttpBuffer &in, std::string &header) {
+    // the header may already be buffered from an earlier read
+    size_t header_len;
+    while ((header_len = in.findHeaderEnd()) == 0) {
+        ssize_t bytes_read = in.readOnce(read_sock);
+        if (bytes_read < 0 && errno == EINTR) continue;
 
-        // Check if the last four characters are "\r\n\r\n"
-        if (recent_chars == "\r\n\r\n") {
-            return header.size(); // End of HTTP header reached
+        // Check if the client has closed the connection or an error occurred
+        if (bytes_read <= 0) {
+            std::cout << "[DEBUG] " << bytes_read << " bytes read. Client closed connection." << std::endl;
+            return -1;
         }
     }
 
-    return 0;
+    // bytes past the header (body, next request) stay in the buffer
+    header = in.take(header_len);
+    return header.size();
 }
 
 // Function to extract the video name from the URI
@@ -108,31 +151,34 @@ std::string modify_uri_bitrate(const std::string& uri, int new_bitrate) {
     return modified_uri;
 }
 
-std::string modify_request_uri(const std::string& original_request, const std::string& new_uri) {
-    // Find the end of the request line (first line of the HTTP request)
-    size_t request_line_end = original_request.find("\r\n");
-    if (request_line_end == std::string::npos) {
-        // Return the original request if no request line is found
-        return original_request;
-    }
+// Returns the segment number of a segment URI, or -1 if there is none
+int get_segment_number(const std::string& uri) {
+    size_t seg_pos = uri.rfind("-seg-");
+    if (seg_pos == std::string::npos) return -1;
 
-    // Extract the request line
-    std::string request_line = original_request.substr(0, request_line_end);
-    std::istringstream request_stream(request_line);
-    std::string method, uri, http_version;
+    int segment = -1;
+    const char* first = uri.data() + seg_pos + 5;
+    auto [end, error] = std::from_chars(first, uri.data() + uri.size(), segment);
+    if (error != std::errc() || end == first || segment < 0) return -1;
+    return segment;
+}
 
-    // Parse the request line into method, URI, and HTTP version
-    if (!(request_stream >> method >> uri >> http_version)) {
-        // If parsing fails, return the original request
-        return original_request;
+// Modifies a segment URI to point at another segment number
+std::string modify_uri_segment(const std::string& uri, int segment) {
+    std::string modified_uri = uri;
+    size_t seg_pos = modified_uri.rfind("-seg-");
+    if (seg_pos != std::string::npos) {
+        size_t number_start = seg_pos + 5;
+        size_t number_end = modified_uri.find_first_not_of("0123456789", number_start);
+        if (number_end == std::string::npos) number_end = modified_uri.size();
+        modified_uri.replace(number_start, number_end - number_start, std::to_string(segment));
     }
+    return modified_uri;
+}
 
-    // Construct the new request line with the modified URI
-    std::string new_request_line = method + " " + new_uri + " " + http_version;
-
-    // Reconstruct the modified request with the new request line
-    std::string modified_request = new_request_line + original_request.substr(request_line_end);
-
+std::string modify_request_uri(const HttpRequest& request, std::string_view new_uri) {
+    std::string modified_request;
+    rewrite_request(request, {.uri = new_uri}, modified_request);
     return modified_request;
 }
 
@@ -146,30 +192,12 @@ std::string modify_request_uri(const std::string& original_request, const std::s
 //     return request.str();
 // }
 
-// Function to update the Host header in an HTTP request
-std::string updateHostHeader(const std::string& originalRequest, const std::string& newHost) {
-    std::istringstream requestStream(originalRequest);
-    std::string line;
-    std::string updatedRequest;
-    bool hostUpdated = false;
-
-    // Process each line of the original request
-    while (std::getline(requestStream, line)) {
-        // Find and replace the Host header
-        if (line.find("Host:") != std::string::npos && !hostUpdated) {
-            updatedRequest += "Host: " + newHost + "\r\n";
-            hostUpdated = true;
-        } else {
-            updatedRequest += line + "\n";  // Append other lines as is
-        }
-    }
-
-    // If the Host header wasn't found, add it
-    if (!hostUpdated) {
-        updatedRequest += "Host: " + newHost + "\r\n";
-    }
-
-    return updatedRequest;
+// Function to update the Host header in an HTTP request (added if the request has none)
+std::string updateHostHeader(const HttpRequest& request, std::string_view newHost) {
+    HttpHeaderField host[] = {{"Host", newHost}};
+    std::string updated_request;
+    rewrite_request(request, {.set = host}, updated_request);
+    return updated_request;
 }
 
 // Extracts the chunk filename from the URI (for logging purposes)
@@ -183,32 +211,11 @@ std::string extract_chunk_name(const std::string& uri) {
 }
 
 // Function to modify the Connection header in an HTTP request
-std::string modify_connection_to_keep_alive(const std::string& original_request) {
-    std::string modified_request = original_request;
-    
-    // Find the "Connection:" header in a case-insensitive manner
-    std::string connection_header = "Connection:";
-    auto pos = std::search(modified_request.begin(), modified_request.end(),
-                           connection_header.begin(), connection_header.end(),
-                           [](char ch1, char ch2) { return std::tolower(ch1) == std::tolower(ch2); });
-
-    // If "Connection:" header is found
-    if (pos != modified_request.end()) {
-        // Move the iterator to the end of "Connection:"
-        pos += connection_header.size();
-
-        // Skip any whitespace after "Connection:"
-        while (pos != modified_request.end() && std::isspace(*pos)) {
-            ++pos;
-        }
-
-        // Find the end of the current connection value (until the next line break)
-        auto end_pos = std::find(pos, modified_request.end(), '\r');
-
-        // Replace the value with "keep-alive"
-        std::string new_value = "keep-alive";
-        modified_request.replace(pos, end_pos, new_value);
-    }
-
+std::string modify_connection_to_keep_alive(const HttpRequest& request) {
+    // only an existing Connection header is changed; keep-alive is the HTTP/1.1 default
+    HttpHeaderField keep_alive[] = {{"Connection", "keep-alive"}};
+    std::string modified_request;
+    rewrite_request(request, {.set = std::span(keep_alive, request.hasHeader("Connection") ? 1 : 0)},
+                    modified_request);
     return modified_request;
 }
@@ -2,11 +2,26 @@
 #define HTTP_HANDLER_HPP
 
 #include <string>
+#include <string_view>
+#include "HttpBuffer.hpp"
+#include "HttpRequest.hpp"
 
 size_t get_content_length(const std::string& response);
 
-// Parses an HTTP request and returns the requested URI
-std::string get_http_uri(const std::string& request);
+// Returns the header with its Content-Length set to length (added if missing)
+std::string set_content_length(const std::string& header, size_t length);
+
+// Returns the status code of an HTTP response, or 0 if the status line is malformed
+int get_status_code(const std::string& response);
+
+// Returns the value of the named header (case-insensitive), or "" if absent
+std::string get_header_value(const std::string& message, const std::string& name);
+
+// Whether the message asks for the connection to be closed after it
+bool is_connection_close(const std::string& message);
+
+// Returns the requested URI of a parsed HTTP request
+std::string get_http_uri(const HttpRequest& request);
 
 // Function to extract the video name from the URI
 std::string extract_video_name(const std::string& uri);
@@ -14,14 +29,24 @@ std::string extract_video_name(const std::string& uri);
 // Modifies the requested URI to adjust the bitrate in the request
 std::string modify_uri_bitrate(const std::string& uri, int new_bitrate);
 
-std::string modify_request_uri(const std::string& original_request, const std::string& new_uri);
+// Returns the segment number of a segment URI (2 for .../vid-500-seg-2.m4s), or -1
+int get_segment_number(const std::string& uri);
+
+// Modifies a segment URI to point at another segment number
+std::string modify_uri_segment(const std::string& uri, int segment);
+
+// Rebuilds the request header with a different request-target
+std::string modify_request_uri(const HttpRequest& request, std::string_view new_uri);
 
-std::string updateHostHeader(const std::string& originalRequest, const std::string& newHost);
+// Rebuilds the request header with the Host header set to newHost
+std::string updateHostHeader(const HttpRequest& request, std::string_view newHost);
 
 // Constructs an HTTP GET request with the modified URI
 std::string construct_http_get_request(const std::string& uri, const std::string& host);
 
-ssize_t read_http_header(int read_sock, std::string &header);
+// Reads from read_sock until `in` holds a complete HTTP header, then moves the header
+// into `header`. Whatever followed it is left in `in`. Returns -1 on close or error.
+ssize_t read_http_header(int read_sock, HttpBuffer &in, std::string &header);
 
 // Handles manifest requests: fetches the manifest from the CDN and sends a modified one to the client
 // std::string handle_manifest_request(const std::string& original_manifest_uri, const std::string& manifest_content);
@@ -30,6 +55,6 @@ ssize_t read_http_header(int read_sock, std::string &header);
 std::string extract_chunk_name(const std::string& uri);
 
 // Function to modify the Connection header in an HTTP request
-std::string modify_connection_to_keep_alive(const std::string& original_request);
+std::string modify_connection_to_keep_alive(const HttpRequest& request);
 
 #endif  // HTTP_HANDLER_HPP
@@ -55,3 +55,66 @@ std::vector<int> parse_available_bitrates(const std::string& manifest_content) {
 
     return bitrates;
 }
+
+// Returns the seconds of video per segment ("duration" in "timescale" units), or 0
+double parse_segment_duration(const std::string& manifest_content) {
+    size_t pos = manifest_content.find("<SegmentTemplate");
+    if (pos == std::string::npos) return 0.0;
+    size_t end_pos = manifest_content.find(">", pos);
+    if (end_pos == std::string::npos) return 0.0;
+    std::string tag = manifest_content.substr(pos, end_pos - pos + 1);
+
+    try {
+        std::string duration = get_attribute_value(tag, "duration");
+        std::string timescale = get_attribute_value(tag, "timescale");
+        if (duration.empty()) return 0.0;
+        double seconds = std::stod(duration) / (timescale.empty() ? 1.0 : std::stod(timescale));
+        return seconds > 0 ? seconds : 0.0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid segment duration in manifest: " << tag << std::endl;
+        return 0.0;
+    }
+}
+
+// Returns one past the end of the element whose start tag begins at pos
+static size_t find_element_end(const std::string& content, size_t pos, const std::string& name) {
+    size_t tag_end = content.find('>', pos);
+    if (tag_end == std::string::npos) return std::string::npos;
+    if (content[tag_end - 1] == '/') return tag_end + 1;  // self-closing
+
+    std::string closing_tag = "</" + name + ">";
+    size_t close_pos = content.find(closing_tag, tag_end);
+    return close_pos == std::string::npos ? std::string::npos : close_pos + closing_tag.size();
+}
+
+// Builds the "-no-list" form of a manifest
+std::string make_no_list_manifest(const std::string& manifest_content) {
+    std::string result;
+    result.reserve(manifest_content.size());
+
+    size_t copied = 0;  // manifest_content before this index is already in result
+    size_t set_pos = 0;
+    while ((set_pos = manifest_content.find("<AdaptationSet", set_pos)) != std::string::npos) {
+        size_t set_end = manifest_content.find("</AdaptationSet>", set_pos);
+        if (set_end == std::string::npos) break;
+
+        // keep the first Representation, drop the others along with their indentation
+        bool first = true;
+        size_t pos = set_pos;
+        while ((pos = manifest_content.find("<Representation", pos)) != std::string::npos && pos < set_end) {
+            size_t end = find_element_end(manifest_content, pos, "Representation");
+            if (end == std::string::npos || end > set_end) break;
+            if (!first) {
+                size_t line_start = manifest_content.find_last_not_of(" \t", pos - 1) + 1;
+                if (manifest_content[line_start - 1] == '\n') --line_start;
+                result.append(manifest_content, copied, line_start - copied);
+                copied = end;
+            }
+            first = false;
+            pos = end;
+        }
+        set_pos = set_end;
+    }
+    result.append(manifest_content, copied, std::string::npos);
+    return result;
+}
@@ -10,4 +10,11 @@ std::string get_attribute_value(const std::string& tag, const std::string& attri
 // Parses the MPEG-DASH manifest (.mpd) file content and returns the available bitrates in Kbps
 std::vector<int> parse_available_bitrates(const std::string& manifest_content);
 
+// Returns the seconds of video per segment given by the SegmentTemplate, or 0 if absent
+double parse_segment_duration(const std::string& manifest_content);
+
+// Builds the "-no-list" form of a manifest: every AdaptationSet keeps only its first
+// Representation, so players see a single bitrate and leave adaptation to the proxy
+std::string make_no_list_manifest(const std::string& manifest_content);
+
 #endif  // MANIFEST_PARSER_HPP
@@ -1,9 +1,14 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <csignal>
 #include <cstdlib>
 #include <unistd.h>  // Required for close()
+#include <memory>
+#include <thread>
+#include <vector>
 #include "Proxy.hpp"
+#include "ProxyOptions.hpp"
 #include "Logger.hpp"
 
 // std::string get_server_IP(std::string &dns_ip, int dns_port) {
@@ -13,8 +18,117 @@
 
 // Function to print usage information in case of incorrect command-line arguments
 void print_usage() {
-    std::cerr << "Usage (Method 1 - No DNS): ./miProxy --nodns <listen-port> <www-ip> <alpha> <log>\n";
-    std::cerr << "Usage (Method 2 - With DNS): ./miProxy --dns <listen-port> <dns-ip> <dns-port> <alpha> <log>\n";
+    std::cerr << "Usage (Method 1 - No DNS): ./miProxy --nodns <listen-port> <www-ip> <alpha> <log> [options]\n";
+    std::cerr << "Usage (Method 2 - With DNS): ./miProxy --dns <listen-port> <dns-ip> <dns-port> <alpha> <log> [options]\n";
+    std::cerr << "Options:\n";
+    std::cerr << "  --workers <n>             Number of event loop threads sharing the listen port (default 1)\n";
+    std::cerr << "  --pool-size <n>           Max upstream connections per web server, per worker (default 64)\n";
+    std::cerr << "  --pool-idle-timeout <s>   Seconds an idle upstream connection is kept open (default 4)\n";
+    std::cerr << "  --splice <on|off>         Relay segment bodies with zero-copy splice() (default on)\n";
+    std::cerr << "  --cache-size <MB>         Memory for cached video segments, 0 to disable (default 64)\n";
+    std::cerr << "  --abr <policy>            Bitrate selection: throughput (1.5x rule) or buffer (BOLA-style) (default throughput)\n";
+    std::cerr << "  --prefetch-depth <n>      Segments fetched ahead of each player, 0 to disable (default 0)\n";
+    std::cerr << "  --manifest-ttl <s>        Seconds a manifest is served from memory before revalidation (default 5)\n";
+    std::cerr << "  --max-titles <n>          Titles whose bitrate ladder and manifest are kept in memory (default 1024)\n";
+    std::cerr << "  --prior-prefix <bits>     Subnet prefix length whose clients share a starting throughput (default 24)\n";
+    std::cerr << "  --prior-half-life <s>     Seconds for a remembered client throughput to halve, 0 to disable (default 60)\n";
+    std::cerr << "  --session-timeout <s>     Seconds a player's ABR state outlives its last connection, 0 to disable (default 60)\n";
+    std::cerr << "  --log-phases <on|off>     Add queue/ttfb/header/body/client seconds to the chunk log (default off)\n";
+    std::cerr << "  --tcp-info-weight <w>     Weight of the kernel's TCP_INFO rate against wall-clock timing, 0-1 (default 0.5)\n";
+}
+
+// Parses the optional "--name value" pairs in argv[first..argc)
+bool parse_options(int argc, char* argv[], int first, ProxyOptions& options) {
+    for (int i = first; i < argc; i += 2) {
+        std::string name = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for option " << name << "\n";
+            return false;
+        }
+        std::string value = argv[i + 1];
+
+        try {
+            if (name == "--workers") {
+                options.workers = std::stoi(value);
+                if (options.workers < 1) {
+                    std::cerr << "--workers must be at least 1\n";
+                    return false;
+                }
+            } else if (name == "--pool-size") {
+                options.pool_size = std::stoul(value);
+            } else if (name == "--pool-idle-timeout") {
+                options.pool_idle_timeout = std::stod(value);
+            } else if (name == "--splice") {
+                if (value != "on" && value != "off") throw std::invalid_argument(value);
+                options.splice = value == "on";
+            } else if (name == "--cache-size") {
+                options.cache_size = std::stoul(value) << 20;
+            } else if (name == "--abr") {
+                if (!make_abr_policy(value)) throw std::invalid_argument(value);
+                options.abr_policy = value;
+            } else if (name == "--prefetch-depth") {
+                options.prefetch_depth = std::stoul(value);
+            } else if (name == "--manifest-ttl") {
+                options.manifest_ttl = std::stod(value);
+            } else if (name == "--max-titles") {
+                options.max_titles = std::stoul(value);
+                if (options.max_titles < 1) throw std::invalid_argument(value);
+            } else if (name == "--prior-prefix") {
+                options.prior_prefix = std::stoi(value);
+                if (options.prior_prefix < 0 || options.prior_prefix > 32) throw std::invalid_argument(value);
+            } else if (name == "--prior-half-life") {
+                options.prior_half_life = std::stod(value);
+            } else if (name == "--session-timeout") {
+                options.session_timeout = std::stod(value);
+            } else if (name == "--log-phases") {
+                if (value != "on" && value != "off") throw std::invalid_argument(value);
+                options.log_phases = value == "on";
+            } else if (name == "--tcp-info-weight") {
+                options.tcp_info_weight = std::stod(value);
+                if (options.tcp_info_weight < 0 || options.tcp_info_weight > 1) throw std::invalid_argument(value);
+            } else {
+                std::cerr << "Unknown option " << name << "\n";
+                return false;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value for option " << name << ": " << value << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Start one Proxy per worker thread; they share the listen port, the bitrate table, the
+// segment cache, the throughput priors and the player sessions
+int run_proxy(int listen_port, const std::string& www_ip, double alpha, Logger& logger, const ProxyOptions& options) {
+    // splice() into a socket the player closed raises SIGPIPE and has no MSG_NOSIGNAL;
+    // ignore it process-wide so a write error is reported as EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+
+    try {
+        BitrateManager bitrate_manager(options.max_titles);
+        SegmentCache segment_cache(options.cache_size);
+        ThroughputPriors throughput_priors(options.prior_prefix, options.prior_half_life);
+        SessionTable session_table(options.session_timeout);
+        std::vector<std::unique_ptr<Proxy>> proxies;
+        for (int i = 0; i < options.workers; ++i) {
+            proxies.push_back(std::make_unique<Proxy>(listen_port, www_ip, 80, alpha, logger, bitrate_manager,
+                                                     segment_cache, throughput_priors, session_table, options));
+        }
+
+        // worker 0 runs on the main thread
+        std::vector<std::thread> threads;
+        for (int i = 1; i < options.workers; ++i) {
+            threads.emplace_back([&proxies, i]() { proxies[i]->run(); });
+        }
+        proxies[0]->run();
+        for (std::thread& thread : threads) thread.join();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        logger.log_message("Error: " + std::string(e.what()));
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -29,9 +143,10 @@ int main(int argc, char* argv[]) {
     double alpha;
     std::string log_path;
     std::string www_ip;
+    ProxyOptions options;
 
     if (mode == "--nodns") {
-        if (argc != 6) {
+        if (argc < 6 || !parse_options(argc, argv, 6, options)) {
             print_usage();
             return 1;
         }
@@ -49,17 +164,10 @@ int main(int argc, char* argv[]) {
         // Log the IP of the web server we're connecting to
         // logger.log_message("Connecting to web server at IP: " + www_ip);
 
-        // Create a Proxy instance and run it
-        try {
-            Proxy proxy(listen_port, www_ip, 80, alpha, logger);
-            proxy.run();
-        } catch (const std::exception& e) {
-            std::cerr << "Error: " << e.what() << "\n";
-            logger.log_message("Error: " + std::string(e.what()));
-            return 1;
-        }
+        // Create the Proxy workers and run them
+        return run_proxy(listen_port, www_ip, alpha, logger, options);
     } else if (mode == "--dns") {
-        if (argc != 7) {
+        if (argc < 7 || !parse_options(argc, argv, 7, options)) {
             print_usage();
             return 1;
         }
@@ -82,15 +190,8 @@ int main(int argc, char* argv[]) {
         // Log the IP of the web server we're connecting to
         // logger.log_message("Connecting to web server at IP: " + www_ip);
 
-        // Create a Proxy instance and run it
-        try {
-            Proxy proxy(listen_port, www_ip, 80, alpha, logger);
-            proxy.run();
-        } catch (const std::exception& e) {
-            std::cerr << "Error: " << e.what() << "\n";
-            logger.log_message("Error: " + std::string(e.what()));
-            return 1;
-        }
+        // Create the Proxy workers and run them
+        return run_proxy(listen_port, www_ip, alpha, logger, options);
     } else {
         std::cerr << "Invalid mode specified. Use either --nodns or --dns.\n";
         print_usage();